@@ -0,0 +1,108 @@
+#include <sys/socket.h>
+#include <errno.h>
+#include <string.h>
+
+#include "Wire.h"
+#include "UartTransport.h"
+#include "SimBus.h"
+
+SimBus::SimBus(uint32_t clock, Link link) : m_DeviceCount{0}, m_Clock{clock}, m_Link{link}, m_Stats{} {
+    for (size_t i = 0; i <= ADDRESS_MAX; i++) {
+        m_AddressMap[i] = -1;
+    }
+}
+
+bool SimBus::AttachDevice(int fd) {
+    if (m_DeviceCount == MAX_DEVICES) {
+        return false;
+    }
+    m_Devices[m_DeviceCount++] = fd;
+    return true;
+}
+
+bool SimBus::Exchange(int fd, const uint8_t* frame, size_t frameSize, uint8_t* reply, size_t replySize) {
+    ssize_t n;
+    while ((n = send(fd, frame, frameSize, MSG_NOSIGNAL)) < 0 && errno == EINTR) {}
+    if (n < 0) {
+        return false;
+    }
+    while ((n = recv(fd, reply, replySize, 0)) < 0 && errno == EINTR) {}
+    return n == (ssize_t) replySize;
+}
+
+void SimBus::Account(size_t dataSize, bool ack) {
+    m_Stats.Transactions++;
+    if (m_Link == Link::UART) {
+        //command, address and length, then the data, 8N1
+        m_Stats.Bytes += 3 + dataSize;
+        m_Stats.Cycles += 10 * (3 + dataSize);
+    }
+    else {
+        m_Stats.Bytes += 1 + dataSize;
+        m_Stats.Cycles += 1 + 9 * (1 + dataSize) + 1;
+    }
+    if (!ack) {
+        m_Stats.Nacks++;
+    }
+}
+
+bool SimBus::Write(uint8_t address, const void* data, size_t size) {
+    uint8_t frame[2 + TwoWire::MAX_WRITE_SIZE];
+    if (size > TwoWire::MAX_WRITE_SIZE) {
+        return false;
+    }
+    frame[0] = TwoWire::FRAME_WRITE;
+    frame[1] = address;
+    memcpy(frame + 2, data, size);
+
+    bool ack = false;
+    uint8_t reply[2];
+    int known = m_AddressMap[address];
+    if (known >= 0 && address != GENERAL_CALL_ADDRESS) {
+        ack = Exchange(m_Devices[known], frame, size + 2, reply, sizeof(reply)) && reply[1];
+    }
+    else {
+        //every slave sees the address, remember the one that answers so that unicast needs one exchange
+        for (size_t i = 0; i < m_DeviceCount; i++) {
+            if (Exchange(m_Devices[i], frame, size + 2, reply, sizeof(reply)) && reply[1]) {
+                ack = true;
+                if (address != GENERAL_CALL_ADDRESS) {
+                    m_AddressMap[address] = i;
+                }
+            }
+        }
+    }
+    if (address == GENERAL_CALL_ADDRESS) {
+        m_Stats.GeneralCalls++;
+    }
+    Account(ack ? size : 0, ack);
+    return ack;
+}
+
+bool SimBus::Read(uint8_t address, void* data, size_t size) {
+    int known = m_AddressMap[address];
+    if (known < 0 || address == GENERAL_CALL_ADDRESS || size > MAX_READ_SIZE) {
+        memset(data, 0xFF, size);
+        Account(0, false);
+        return false;
+    }
+    uint8_t frame[3] {TwoWire::FRAME_READ, address, (uint8_t) size};
+    uint8_t reply[1 + MAX_READ_SIZE];
+    bool ack = Exchange(m_Devices[known], frame, sizeof(frame), reply, size + 1);
+    if (ack) {
+        memcpy(data, reply + 1, size);
+    }
+    else {
+        memset(data, 0xFF, size);
+    }
+    Account(ack ? size : 0, ack);
+    return ack;
+}
+
+size_t SimBus::GetMaxTransfer() const {
+    return m_Link == Link::UART ? comm::UartTransport::MAX_FRAME : BUFFER_LENGTH;
+}
+
+uint64_t SimBus::CyclesToMicros(uint64_t cycles) const {
+    return cycles * 1000000ull / m_Clock;
+}
@@ -0,0 +1,79 @@
+#ifndef __SIMBUS_H
+#define __SIMBUS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+Master end of the simulated I2C bus (see Wire.h in ArduinoNative).
+Every device is a socket to a sketch process. Transactions are timed as if they ran on a real bus at the given clock.
+
+With Link::UART the devices use comm::UnixSocketTransport over the same frames, and the transactions are timed
+as the 'W'/'R' frames of comm::UartTransport on an RS-485 line at the given baud rate.
+*/
+class SimBus {
+public:
+    enum class Link {
+        I2C,
+        UART
+    };
+
+    static constexpr uint8_t GENERAL_CALL_ADDRESS = 0;
+    static constexpr uint8_t ADDRESS_MAX = 0x7F;
+    static constexpr size_t MAX_DEVICES = 112; //0x08 to 0x77
+    static constexpr size_t MAX_READ_SIZE = 255;
+
+    struct Stats {
+        uint64_t Transactions;
+        uint64_t Bytes;        //including the address byte (I2C) or the frame header (UART)
+        uint64_t Cycles;       //I2C: SCL cycles - start, address, data and ack bits, stop. UART: bit times.
+        uint64_t Nacks;
+        uint64_t GeneralCalls; //writes to GENERAL_CALL_ADDRESS
+    };
+
+private:
+    int      m_Devices[MAX_DEVICES];
+    size_t   m_DeviceCount;
+
+    int      m_AddressMap[ADDRESS_MAX + 1]; //device index that acknowledged the address, -1 if not known yet
+
+    uint32_t m_Clock;
+    Link     m_Link;
+
+    Stats    m_Stats;
+
+    bool Exchange(int fd, const uint8_t* frame, size_t frameSize, uint8_t* reply, size_t replySize);
+
+    void Account(size_t dataSize, bool ack);
+
+public:
+    SimBus(uint32_t clock, Link link = Link::I2C);
+
+    bool AttachDevice(int fd);
+
+    bool Write(uint8_t address, const void* data, size_t size);
+    bool Read(uint8_t address, void* data, size_t size);
+
+    inline const Stats& GetStats() const {
+        return m_Stats;
+    }
+
+    inline uint32_t GetClock() const {
+        return m_Clock;
+    }
+
+    inline void SetClock(uint32_t clock) {
+        m_Clock = clock;
+    }
+
+    inline Link GetLink() const {
+        return m_Link;
+    }
+
+    //the most a single write or read may carry
+    size_t GetMaxTransfer() const;
+
+    uint64_t CyclesToMicros(uint64_t cycles) const;
+};
+
+#endif
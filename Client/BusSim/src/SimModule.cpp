@@ -0,0 +1,70 @@
+#include "Arduino.h"
+
+#include "ComponentMain.h"
+#include "BombComponent.h"
+#include "BombInterface.h"
+#include "BombConfig.h"
+
+/*
+The module every simulated bus device runs. Its traffic is that of a real module in a game without interaction:
+the clock arrives with TIMER_SYNC, strike syncs on STRIKE. When the bomb is defused, it reports what it has received.
+*/
+class SimModule : public BombModule {
+private:
+    uint32_t m_TicksReceived;
+    uint32_t m_EventsReceived;
+
+public:
+    SimModule() : m_TicksReceived{0}, m_EventsReceived{0} {
+
+    }
+
+    const char* GetName() override {
+        return "Bus Sim";
+    }
+
+    BombConfig::ModuleFlag GetModuleFlags() override {
+        return BombConfig::NONE;
+    }
+
+    void LoadConfiguration(ModuleConfig* config) override {
+
+    }
+
+    const InfoStreamBuilderBase::VariableParam* GetVariableInfo() override {
+        return BOMB_NO_VARIABLES;
+    }
+
+    bconf::BombEventBit GetAcceptedEvents() override {
+        return bconf::TIMER_TICK_BIT | bconf::TIMER_SYNC_BIT | bconf::STRIKE_BIT;
+    }
+
+    void OnEvent(uint8_t id, void* data) override {
+        switch (id) {
+            case bconf::RESET:
+                m_TicksReceived = 0;
+                m_EventsReceived = 0;
+                return;
+            case bconf::TIMER_TICK:
+                m_TicksReceived++;
+                break;
+            case bconf::DEFUSAL: {
+                char report[48];
+                snprintf(report, sizeof(report), "ticks %lu events %lu", (unsigned long) m_TicksReceived, (unsigned long) m_EventsReceived);
+                m_Bomb->SendServerMessage(bprotocol::SRVMSG_INFO, report, false);
+                break;
+            }
+        }
+        m_EventsReceived++;
+    }
+};
+
+SimModule mod;
+
+void setup() {
+    ComponentMain::GetInstance()->Setup(&mod);
+}
+
+void loop() {
+    ComponentMain::GetInstance()->Loop();
+}
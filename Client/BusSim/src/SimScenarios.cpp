@@ -0,0 +1,402 @@
+#include "SimScenarios.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "Arduino.h"
+#include "UartTransport.h"
+#include "BombClient.h"
+#include "BombInterface.h"
+#include "SimServer.h"
+
+namespace scenario {
+
+    static bool Report(const char* name, bool ok, const char* detail) {
+        printf("scenario %-24s %s%s%s\n", name, ok ? "ok" : "FAILED", (!ok && detail[0]) ? " - " : "", ok ? "" : detail);
+        return ok;
+    }
+
+    /*
+    Two comm::UartTransport slaves on one RS-485 line, fed byte by byte as the line carries them.
+    A slave does not hear its own answers, everyone else does.
+    */
+    class UartLine {
+    public:
+        static constexpr size_t SLAVES = 2;
+        static constexpr uint8_t ANSWER_SIZE = 4;
+
+        struct Slave {
+            HardwareSerial       Port;
+            comm::UartTransport  Link;
+            uint8_t              Answer[ANSWER_SIZE];
+            uint8_t              Received[comm::UartTransport::MAX_FRAME];
+            size_t               ReceivedSize;
+            int                  Requests;
+            uint8_t              Pending[comm::UartTransport::MAX_FRAME]; //written, not yet on the line
+            size_t               PendingSize;
+
+            Slave() : Link(&Port, 250000, 2), Answer{}, ReceivedSize{0}, Requests{0}, PendingSize{0} {}
+        };
+
+    private:
+        Slave m_Slaves[SLAVES];
+
+        static void OnOutput(const uint8_t* data, size_t size, void* param) {
+            Slave* s = static_cast<Slave*>(param);
+            size = min(size, sizeof(s->Pending) - s->PendingSize);
+            memcpy(s->Pending + s->PendingSize, data, size);
+            s->PendingSize += size;
+        }
+
+        static void OnReceive(size_t available, void* param) {
+            Slave* s = static_cast<Slave*>(param);
+            s->ReceivedSize = s->Link.Read(s->Received, sizeof(s->Received));
+        }
+
+        static void OnRequest(void* param) {
+            Slave* s = static_cast<Slave*>(param);
+            s->Requests++;
+            s->Link.Write(s->Answer, sizeof(s->Answer));
+        }
+
+        //puts bytes on the line from the master (from = SLAVES) or a slave, and whatever they make the slaves answer
+        void Transmit(const uint8_t* data, size_t size, size_t from) {
+            for (size_t i = 0; i < SLAVES; i++) {
+                if (i != from) {
+                    m_Slaves[i].Port.Feed(data, size);
+                }
+            }
+            for (size_t i = 0; i < SLAVES; i++) {
+                m_Slaves[i].Link.Poll();
+            }
+            for (size_t i = 0; i < SLAVES; i++) {
+                Slave* s = &m_Slaves[i];
+                if (s->PendingSize) {
+                    uint8_t answer[sizeof(s->Pending)];
+                    size_t answerSize = s->PendingSize;
+                    memcpy(answer, s->Pending, answerSize);
+                    s->PendingSize = 0;
+                    Transmit(answer, answerSize, i);
+                }
+            }
+        }
+
+    public:
+        UartLine() {
+            for (size_t i = 0; i < SLAVES; i++) {
+                Slave* s = &m_Slaves[i];
+                s->Port.SetOutput(OnOutput, s);
+                s->Link.SetHandlers(OnReceive, OnRequest, s);
+            }
+        }
+
+        inline Slave* GetSlave(size_t i) {
+            return &m_Slaves[i];
+        }
+
+        void MasterWrite(uint8_t address, const uint8_t* data, uint8_t size) {
+            uint8_t frame[3 + comm::UartTransport::MAX_FRAME];
+            frame[0] = comm::UartTransport::FRAME_WRITE;
+            frame[1] = address;
+            frame[2] = size;
+            memcpy(frame + 3, data, size);
+            Transmit(frame, 3 + size, SLAVES);
+        }
+
+        void MasterRead(uint8_t address, uint8_t size) {
+            uint8_t frame[] {comm::UartTransport::FRAME_READ, address, size};
+            Transmit(frame, sizeof(frame), SLAVES);
+        }
+    };
+
+    //An answer that reads as a frame header for another slave must not make that slave answer too
+    static bool UartForeignAnswer() {
+        static constexpr uint8_t ADDRESS_A = 0x10;
+        static constexpr uint8_t ADDRESS_B = 0x11;
+        UartLine line;
+        UartLine::Slave* a = line.GetSlave(0);
+        UartLine::Slave* b = line.GetSlave(1);
+        a->Link.Begin(ADDRESS_A);
+        b->Link.Begin(ADDRESS_B);
+        uint8_t answerA[] {comm::UartTransport::FRAME_READ, ADDRESS_B, 2, comm::UartTransport::FRAME_READ};
+        memcpy(a->Answer, answerA, sizeof(answerA));
+        b->Answer[0] = 0x42;
+
+        line.MasterRead(ADDRESS_A, sizeof(answerA));
+        //a write to A that looks like a read of B, then one for B itself
+        uint8_t writeA[] {comm::UartTransport::FRAME_READ, ADDRESS_B, 1};
+        line.MasterWrite(ADDRESS_A, writeA, sizeof(writeA));
+        uint8_t writeB[] {0x5A};
+        line.MasterWrite(ADDRESS_B, writeB, sizeof(writeB));
+        line.MasterRead(ADDRESS_B, 1);
+
+        char detail[96];
+        snprintf(detail, sizeof(detail), "A answered %d reads, B %d, B received %d bytes", a->Requests, b->Requests, (int) b->ReceivedSize);
+        bool ok = a->Requests == 1 && b->Requests == 1 && a->ReceivedSize == sizeof(writeA)
+            && b->ReceivedSize == sizeof(writeB) && b->Received[0] == writeB[0];
+        return Report("uart-foreign-answer", ok, detail);
+    }
+
+    /*
+    A link on which the scenario is the master. A write or read reaches the handlers at once, as the interrupt would,
+    and nothing else runs in between.
+    */
+    class ScriptedLink : public comm::Transport {
+    public:
+        static constexpr size_t MAX_TRANSFER = 64;
+
+    private:
+        uint8_t m_Rx[MAX_TRANSFER];
+        size_t  m_RxSize;
+        size_t  m_RxPos;
+        uint8_t m_Tx[MAX_TRANSFER];
+        size_t  m_TxSize;
+        size_t  m_TxLimit;
+
+    public:
+        ScriptedLink() : m_RxSize{0}, m_RxPos{0}, m_TxSize{0}, m_TxLimit{0} {}
+
+        void Begin(uint8_t address) override {}
+
+        size_t Available() override {
+            return m_RxSize - m_RxPos;
+        }
+
+        int Read() override {
+            return m_RxPos < m_RxSize ? m_Rx[m_RxPos++] : -1;
+        }
+
+        int Peek() override {
+            return m_RxPos < m_RxSize ? m_Rx[m_RxPos] : -1;
+        }
+
+        size_t Read(void* dest, size_t size) override {
+            size = min(size, Available());
+            memcpy(dest, m_Rx + m_RxPos, size);
+            m_RxPos += size;
+            return size;
+        }
+
+        size_t GetRequestSize() override {
+            return m_TxLimit - m_TxSize;
+        }
+
+        size_t Write(const void* data, size_t size) override {
+            size = min(size, GetRequestSize());
+            memcpy(m_Tx + m_TxSize, data, size);
+            m_TxSize += size;
+            return size;
+        }
+
+        void MasterWrite(const uint8_t* data, size_t size) {
+            m_RxSize = min(size, sizeof(m_Rx));
+            memcpy(m_Rx, data, m_RxSize);
+            m_RxPos = 0;
+            m_OnReceive(m_RxSize, m_HandlerParam);
+        }
+
+        size_t MasterRead(uint8_t* out, size_t size) {
+            m_TxSize = 0;
+            m_TxLimit = min(size, sizeof(m_Tx));
+            m_OnRequest(m_HandlerParam);
+            memcpy(out, m_Tx, m_TxSize);
+            return m_TxSize;
+        }
+    };
+
+    //A BombClient in this process, runs its main loop only when the scenario calls ProcessCommands
+    class ClientUnderTest {
+    public:
+        static constexpr size_t MAX_EVENTS = 16;
+
+        ScriptedLink Link;
+        BombClient   Client;
+        uint8_t      Events[MAX_EVENTS]; //as dispatched
+        size_t       EventCount;
+
+    private:
+        static void OnEvent(uint8_t eventId, void* data, ClientUnderTest* self) {
+            if (self->EventCount < MAX_EVENTS) {
+                self->Events[self->EventCount] = eventId;
+            }
+            self->EventCount++;
+        }
+
+    public:
+        ClientUnderTest() : EventCount{0} {
+            Client.SetTransport(&Link);
+            Client.AddEventDispatcher(OnEvent, this);
+            Client.SetCoalescedEvents(bconf::COALESCED_BITS);
+            Client.Attach(SimServer::SCAN_FIRST);
+        }
+
+        void Post(uint8_t command, const uint8_t* params, size_t size) {
+            uint8_t packet[ScriptedLink::MAX_TRANSFER];
+            packet[0] = SimClientSocket::COMM_MAGIC_START;
+            packet[1] = (uint8_t) (1 + size);
+            packet[2] = (uint8_t) ((1 + size) >> 8);
+            packet[3] = command;
+            if (size) {
+                memcpy(packet + 4, params, size);
+            }
+            Link.MasterWrite(packet, 4 + size);
+        }
+
+        //the way the server sends state updates, nothing is read back
+        void PostEvent(uint8_t eventId) {
+            Post(SimServer::CMD_EVENT | SimServer::CMD_FLAG_NO_ACK, &eventId, 1);
+        }
+
+        //the head window first, then the rest of the packet, as SimClientSocket::ReadPacket; returns the contents size or -1
+        int ReadPacket(uint8_t* out, size_t capacity) {
+            size_t have = Link.MasterRead(out, min(capacity, SimClientSocket::HEAD_WINDOW_SIZE));
+            if (have < 3 || out[0] != SimClientSocket::COMM_MAGIC_START) {
+                return -1;
+            }
+            size_t total = 3 + (out[1] | (out[2] << 8));
+            while (have < total && total <= capacity) {
+                size_t read = Link.MasterRead(out + have, total - have);
+                if (!read) {
+                    return -1;
+                }
+                have += read;
+            }
+            return have == total ? (int) (total - 3) : -1;
+        }
+
+        //POLL as Server.sync sends it, returns the number of requests in the answer or -1
+        int Poll() {
+            Post(SimServer::CMD_POLL, nullptr, 0);
+            Client.ProcessCommands();
+            uint8_t answer[ScriptedLink::MAX_TRANSFER];
+            return ReadPacket(answer, sizeof(answer)) > 0 ? answer[3] : -1;
+        }
+
+        size_t CountEvents(uint8_t eventId) {
+            size_t count = 0;
+            for (size_t i = 0; i < min(EventCount, MAX_EVENTS); i++) {
+                count += Events[i] == eventId;
+            }
+            return count;
+        }
+    };
+
+    //Queued ticks collapse into the newest one, which keeps its place behind what came before it
+    static bool CoalescedTicks() {
+        ClientUnderTest c;
+        c.PostEvent(bconf::TIMER_TICK);
+        c.PostEvent(bconf::TIMER_TICK);
+        c.PostEvent(bconf::STRIKE);
+        c.PostEvent(bconf::TIMER_TICK);
+        c.Client.ProcessCommands();
+
+        char detail[96];
+        snprintf(detail, sizeof(detail), "dispatched %d events, %d ticks, first %d", (int) c.EventCount,
+            (int) c.CountEvents(bconf::TIMER_TICK), c.EventCount ? c.Events[0] : -1);
+        bool ok = c.EventCount == 2 && c.Events[0] == bconf::STRIKE && c.Events[1] == bconf::TIMER_TICK;
+        return Report("coalesced-ticks", ok, detail);
+    }
+
+    //State updates cannot take the last command slots, a strike behind a pile of ticks still gets in
+    static bool ReservedCommandSlots() {
+        ClientUnderTest c;
+        for (int i = 0; i < 8; i++) {
+            c.PostEvent(bconf::TIMER_TICK);
+        }
+        c.PostEvent(bconf::STRIKE);
+        c.PostEvent(bconf::STRIKE);
+        c.Client.ProcessCommands();
+
+        char detail[96];
+        snprintf(detail, sizeof(detail), "dispatched %d ticks, %d strikes", (int) c.CountEvents(bconf::TIMER_TICK),
+            (int) c.CountEvents(bconf::STRIKE));
+        bool ok = c.CountEvents(bconf::TIMER_TICK) == 1 && c.CountEvents(bconf::STRIKE) == 2;
+        return Report("reserved-command-slots", ok, detail);
+    }
+
+    //A packet that stops short is cancelled once it has stalled, and its arena block comes back
+    static bool TruncatedPacket() {
+        ClientUnderTest c;
+        uint8_t truncated[] {SimClientSocket::COMM_MAGIC_START, 20, 0, SimServer::CMD_EVENT, 1, 2};
+        c.Link.MasterWrite(truncated, sizeof(truncated));
+        usleep((ASYNCI2C_TRANSFER_TIMEOUT + 100) * 1000ul);
+        c.Client.ProcessCommands();
+        c.PostEvent(bconf::STRIKE);
+        c.Client.ProcessCommands();
+
+        char detail[96];
+        snprintf(detail, sizeof(detail), "cancelled %u, reclaimed %lu bytes, %d strikes after", (unsigned int) c.Client.GetTransferCancelCount(),
+            (unsigned long) c.Client.GetReclaimedBytes(), (int) c.CountEvents(bconf::STRIKE));
+        bool ok = c.Client.GetTransferCancelCount() == 1 && c.Client.GetReclaimedBytes() == 20 && c.CountEvents(bconf::STRIKE) == 1;
+        return Report("truncated-packet", ok, detail);
+    }
+
+    //An event or response without its ID byte is dropped, and the packets after it are read as usual
+    static bool EmptyPackets() {
+        ClientUnderTest c;
+        c.Post(SimServer::CMD_EVENT | SimServer::CMD_FLAG_NO_ACK, nullptr, 0);
+        c.Post(SimServer::CMD_RESPONSE | SimServer::CMD_FLAG_NO_ACK, nullptr, 0);
+        c.Client.ProcessCommands();
+        c.PostEvent(bconf::STRIKE);
+        c.Client.ProcessCommands();
+
+        char detail[96];
+        snprintf(detail, sizeof(detail), "dispatched %d events, first %d", (int) c.EventCount, c.EventCount ? c.Events[0] : -1);
+        bool ok = c.EventCount == 1 && c.Events[0] == bconf::STRIKE;
+        return Report("empty-packets", ok, detail);
+    }
+
+    //The discovery ping drops a reply the master never read, and is answered itself
+    static bool PingDropsReply() {
+        ClientUnderTest c;
+        uint8_t flags = 0;
+        c.Post(SimServer::CMD_STATS, &flags, 1);
+        c.Client.ProcessCommands();
+        uint8_t ping = 0xEA;
+        c.Link.MasterWrite(&ping, 1);
+        c.Client.ProcessCommands();
+        uint8_t answer[ScriptedLink::MAX_TRANSFER];
+        size_t size = c.Link.MasterRead(answer, sizeof(answer));
+
+        char detail[96];
+        snprintf(detail, sizeof(detail), "cancelled %u, reclaimed %lu bytes, answered %d bytes, first %02X", (unsigned int) c.Client.GetTransferCancelCount(),
+            (unsigned long) c.Client.GetReclaimedBytes(), (int) size, size ? answer[0] : 0);
+        bool ok = c.Client.GetTransferCancelCount() > 0 && c.Client.GetReclaimedBytes() > 0 && size == 1 && answer[0] == 0xAE;
+        return Report("ping-drops-reply", ok, detail);
+    }
+
+    //A REQUEST_RETRY request whose response never came is in the next POLL again, and gone once answered
+    static bool LostResponseRetried() {
+        ClientUnderTest c;
+        c.Client.SetRequestPolicy(HASHID("GetBombConfig"), BombClient::REQUEST_RETRY);
+        c.Client.QueueRequest(HASHID("GetBombConfig"));
+        int first = c.Poll();
+        usleep((BOMBCLIENT_RESPONSE_TIMEOUT + 100) * 1000ul);
+        c.Client.ProcessCommands();
+        int retried = c.Poll();
+        uint8_t channel = 0; //the only request, in the first pool slot
+        c.Post(SimServer::CMD_RESPONSE | SimServer::CMD_FLAG_NO_ACK, &channel, 1);
+        c.Client.ProcessCommands();
+        int answered = c.Poll();
+
+        char detail[96];
+        snprintf(detail, sizeof(detail), "requests polled %d, after the timeout %d, after the response %d", first, retried, answered);
+        bool ok = first == 1 && retried == 1 && answered == 0;
+        return Report("lost-response-retried", ok, detail);
+    }
+
+    bool RunAll(SimBus::Link link) {
+        bool ok = true;
+        ok &= CoalescedTicks();
+        ok &= ReservedCommandSlots();
+        ok &= TruncatedPacket();
+        ok &= EmptyPackets();
+        ok &= PingDropsReply();
+        ok &= LostResponseRetried();
+        if (link == SimBus::Link::UART) {
+            ok &= UartForeignAnswer();
+        }
+        return ok;
+    }
+}
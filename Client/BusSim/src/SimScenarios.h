@@ -0,0 +1,15 @@
+#ifndef __SIMSCENARIOS_H
+#define __SIMSCENARIOS_H
+
+#include "SimBus.h"
+
+/*
+Protocol checks that BusSim runs before the benchmark, so that what the numbers rest on is asserted and not only printed.
+Each check prints one line, ok or FAILED with what it saw, and a failed one fails the run.
+*/
+namespace scenario {
+    //runs every check that applies to the link, returns whether all passed
+    bool RunAll(SimBus::Link link);
+}
+
+#endif
@@ -0,0 +1,530 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "BombInterface.h"
+#include "SimServer.h"
+
+//SimClientSocket
+
+bool SimClientSocket::SendPacket(const uint8_t* content, size_t size) {
+    uint8_t buf[3 + MAX_PACKET_SIZE];
+    if (size > MAX_PACKET_SIZE) {
+        return false;
+    }
+    buf[0] = COMM_MAGIC_START;
+    buf[1] = size & 0xFF;
+    buf[2] = size >> 8;
+    memcpy(buf + 3, content, size);
+
+    size_t remaining = size + 3;
+    size_t index = 0;
+    while (remaining > 0) {
+        size_t writeSize = min(remaining, m_Bus->GetMaxTransfer());
+        if (!m_Bus->Write(m_Address, buf + index, writeSize)) {
+            return false;
+        }
+        remaining -= writeSize;
+        index += writeSize;
+    }
+    return true;
+}
+
+bool SimClientSocket::TakeRx(uint8_t* out, size_t size) {
+    while (m_RxSize < size) {
+        size_t readSize = min(m_Bus->GetMaxTransfer(), size - m_RxSize);
+        if (!m_Bus->Read(m_Address, m_Rx + m_RxSize, readSize)) {
+            m_RxSize = 0;
+            return false;
+        }
+        m_RxSize += readSize;
+    }
+    memcpy(out, m_Rx, size);
+    m_RxSize -= size;
+    memmove(m_Rx, m_Rx + size, m_RxSize);
+    return true;
+}
+
+int SimClientSocket::ReadPacket(uint8_t* buffer, size_t capacity) {
+    for (int attempt = 0; ; attempt++) {
+        if (!m_RxSize) {
+            if (!m_Bus->Read(m_Address, m_Rx, HEAD_WINDOW_SIZE)) {
+                return -1;
+            }
+            m_RxSize = HEAD_WINDOW_SIZE;
+        }
+        uint8_t start = m_Rx[0];
+        if (start == COMM_MAGIC_START) {
+            break;
+        }
+        m_RxSize = 0;
+        if (start != COMM_PADDING && (start & STATUS_INVALID)) {
+            fprintf(stderr, "Invalid packet start from %02X: %02X\n", m_Address, start);
+            return -1;
+        }
+        //a status byte or nothing at all, the client has not got to our command yet
+        if (attempt == NOT_READY_RETRIES) {
+            fprintf(stderr, "Client %02X not ready\n", m_Address);
+            return -1;
+        }
+        (*m_NotReadyReads)++;
+    }
+    uint8_t header[3];
+    if (!TakeRx(header, sizeof(header))) {
+        return -1;
+    }
+    size_t size = header[1] | (header[2] << 8);
+    if (size > capacity || size > MAX_PACKET_SIZE) {
+        fprintf(stderr, "Packet from %02X too large: %d\n", m_Address, (int) size);
+        m_RxSize = 0;
+        return -1;
+    }
+    if (!TakeRx(buffer, size)) {
+        return -1;
+    }
+    if (m_RxSize && m_Rx[0] != COMM_MAGIC_START) {
+        m_RxSize = 0; //padding, the next packet starts in a new window
+    }
+    return (int) size;
+}
+
+int SimClientSocket::ReadStatus() {
+    //read even with a packet waiting already, the probe has armed the client to answer this one read with its status
+    uint8_t status;
+    if (!m_Bus->Read(m_Address, &status, 1) || m_RxSize || (status & STATUS_INVALID)) {
+        return -1;
+    }
+    return status;
+}
+
+bool SimClientSocket::ProbeStatus() {
+    uint8_t probe = STATUS_PROBE;
+    return m_Bus->Write(m_Address, &probe, 1);
+}
+
+int SimClientSocket::SendCommand(uint8_t cmd, const uint8_t* params, size_t paramsSize, uint8_t* response, size_t capacity) {
+    if (!PostCommand(cmd & ~SimServer::CMD_FLAG_NO_ACK, params, paramsSize)) {
+        return -1;
+    }
+    return ReadPacket(response, capacity);
+}
+
+bool SimClientSocket::PostCommand(uint8_t cmd, const uint8_t* params, size_t paramsSize) {
+    uint8_t data[1 + MAX_PACKET_SIZE];
+    if (paramsSize > MAX_PACKET_SIZE) {
+        return false;
+    }
+    data[0] = cmd;
+    memcpy(data + 1, params, paramsSize);
+    return SendPacket(data, paramsSize + 1);
+}
+
+bool SimClientSocket::SendCommandResponse(uint8_t cmd, uint8_t channel, const uint8_t* params, size_t paramsSize) {
+    uint8_t data[2 + MAX_PACKET_SIZE];
+    if (paramsSize > MAX_PACKET_SIZE) {
+        return false;
+    }
+    data[0] = cmd;
+    data[1] = channel;
+    memcpy(data + 2, params, paramsSize);
+    return SendPacket(data, paramsSize + 2);
+}
+
+//SimServer
+
+SimServer::SimServer(SimBus* bus, bool broadcast) :
+    m_Bus{bus},
+    m_Broadcast{broadcast},
+    m_DeviceCount{0},
+    m_Stats{},
+    m_TimerMs{0},
+    m_TimerScale{1.0f},
+    m_SinceSyncMs{0},
+    m_Strikes{0} {
+
+}
+
+size_t SimServer::Discover() {
+    m_DeviceCount = 0;
+    for (uint8_t addr = SCAN_FIRST; addr <= SCAN_LAST; addr++) {
+        if (!m_Bus->Write(addr, nullptr, 0)) {
+            continue;
+        }
+        uint8_t ping = 0xEA;
+        uint8_t pong = 0;
+        m_Bus->Write(addr, &ping, 1);
+        if (m_Bus->Read(addr, &pong, 1) && pong == 0xAE) {
+            Device* dev = &m_Devices[m_DeviceCount++];
+            *dev = Device{};
+            dev->Socket = SimClientSocket(m_Bus, addr, &m_Stats.NotReadyReads);
+        }
+        else {
+            fprintf(stderr, "Device ping failed: %02X\n", addr);
+        }
+    }
+    return m_DeviceCount;
+}
+
+size_t SimServer::ShakeHands(const char* request) {
+    //greeting, then the opcode table - make_handshake_request in server.py
+    uint8_t handshake[SimClientSocket::MAX_PACKET_SIZE];
+    size_t handshakeSize = strlen(request) + 1;
+    memcpy(handshake, request, handshakeSize);
+    handshake[handshakeSize++] = HANDLER_COUNT;
+    memcpy(handshake + handshakeSize, HANDLERS, sizeof(HANDLERS));
+    handshakeSize += sizeof(HANDLERS);
+
+    size_t accepted = 0;
+    for (size_t i = 0; i < m_DeviceCount; i++) {
+        Device* dev = &m_Devices[i];
+        uint8_t resp[SimClientSocket::MAX_PACKET_SIZE];
+        int size = dev->Socket.SendCommand(CMD_HANDSHAKE, handshake, handshakeSize, resp, sizeof(resp));
+        size_t checkLen = size > 0 ? strnlen((const char*) resp, size) : 0;
+        if (size <= 0 || (int) checkLen + 1 + 5 + 4 > size) {
+            fprintf(stderr, "Handshake with %02X failed!\n", dev->Socket.GetAddress());
+            continue;
+        }
+        char check[8] {};
+        memcpy(check, resp, min(checkLen, sizeof(check) - 1));
+        if (HashID(check) != HANDSHAKE_CHECK_HASH) {
+            fprintf(stderr, "Handshake with %02X failed: bad check code\n", dev->Socket.GetAddress());
+            continue;
+        }
+        //check code, link info, module info
+        const uint8_t* link = resp + checkLen + 1;
+        memcpy(&dev->MaxClock, link, sizeof(dev->MaxClock));
+        dev->ReportedErrors = link[4];
+        memcpy(&dev->AcceptedEvents, link + 5, sizeof(dev->AcceptedEvents));
+        m_Devices[accepted++] = *dev;
+    }
+    m_DeviceCount = accepted;
+    return accepted;
+}
+
+bool SimServer::PrintClientStats(size_t index) {
+    //bucket count, handler count, command count, then 16 byte records: count, min, max, mean, buckets
+    static constexpr size_t RECORD_SIZE = 16;
+    static const char* COMMAND_NAMES[] {"POLL", "RESPONSE", "EVENT", "HANDSHAKE", "EVENT_BATCH", "STATS"};
+
+    Device* dev = &m_Devices[index];
+    uint8_t flags = 0;
+    uint8_t resp[SimClientSocket::MAX_PACKET_SIZE];
+    int size = dev->Socket.SendCommand(CMD_STATS, &flags, 1, resp, sizeof(resp));
+    if (size < 3) {
+        return false;
+    }
+    uint8_t handlerCount = resp[1];
+    uint8_t commandCount = resp[2];
+    if ((size_t) size < 3 + handlerCount * (4 + 2 * RECORD_SIZE) + commandCount * RECORD_SIZE) {
+        return false;
+    }
+
+    auto printRecord = [](const char* name, const char* kind, const uint8_t* rec) {
+        uint16_t v[4];
+        memcpy(v, rec, sizeof(v));
+        fprintf(stderr, "  %-20s %-8s count %5u min %5u mean %5u max %5u ms\n", name, kind, v[0], v[1], v[3], v[2]);
+    };
+
+    fprintf(stderr, "Module %02X latencies\n", dev->Socket.GetAddress());
+    const uint8_t* pos = resp + 3;
+    for (uint8_t i = 0; i < handlerCount; i++) {
+        IDHASH handler;
+        memcpy(&handler, pos, sizeof(handler));
+        char name[12];
+        snprintf(name, sizeof(name), "%08lX", (unsigned long) handler);
+        printRecord(name, "wait", pos + 4);
+        printRecord(name, "response", pos + 4 + RECORD_SIZE);
+        pos += 4 + 2 * RECORD_SIZE;
+    }
+    for (uint8_t i = 0; i < commandCount; i++) {
+        printRecord(i < sizeof(COMMAND_NAMES) / sizeof(*COMMAND_NAMES) ? COMMAND_NAMES[i] : "?", "queue", pos);
+        pos += RECORD_SIZE;
+    }
+    return true;
+}
+
+size_t SimServer::ReadVarint(const uint8_t* data, size_t size, size_t* value) {
+    *value = 0;
+    for (size_t i = 0; i < size && i < 3; i++) {
+        *value |= (size_t) (data[i] & 0x7F) << (7 * i);
+        if (!(data[i] & 0x80)) {
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+uint32_t SimServer::NegotiateClock() {
+    //Server.negotiate_clock, the bus starts at the clock it was made with
+    uint32_t usable = CLOCK_RATES[sizeof(CLOCK_RATES) / sizeof(*CLOCK_RATES) - 1];
+    uint32_t base = m_Bus->GetClock();
+    for (size_t i = 0; i < m_DeviceCount; i++) {
+        const Device* dev = &m_Devices[i];
+        usable = min(usable, dev->ReportedErrors ? base : dev->MaxClock);
+    }
+    uint32_t clock = base;
+    for (uint32_t rate : CLOCK_RATES) {
+        if (rate > clock && rate <= usable) {
+            clock = rate;
+        }
+    }
+    m_Bus->SetClock(clock);
+    return clock;
+}
+
+bool SimServer::HandleRequest(Device* dev, IDHASH handler, const uint8_t* params, size_t paramsSize, uint8_t* response, size_t* responseSize) {
+    *responseSize = 0;
+    if (handler == GET_STRIKES) {
+        response[0] = m_Strikes;
+        *responseSize = 1;
+    }
+    else if (handler == ADD_STRIKE) {
+        AddStrike();
+    }
+    else if (handler == OUTPUT_DEBUG_MESSAGE) {
+        //type, length, text - the simulated modules report what they have received this way
+        if (paramsSize >= 3) {
+            char text[64] {};
+            size_t len = min(params[1] | (params[2] << 8), (int) min(paramsSize - 3, sizeof(text) - 1));
+            memcpy(text, params + 3, len);
+            unsigned long ticks, events;
+            if (sscanf(text, "ticks %lu events %lu", &ticks, &events) == 2) {
+                dev->Reported = true;
+                dev->ReportedTicks = ticks;
+                dev->ReportedEvents = events;
+            }
+        }
+    }
+    else if (handler != ACK_READY_TO_ARM && handler != DEFUSE_COMPONENT) {
+        return false;
+    }
+    return true;
+}
+
+void SimServer::Sync() {
+    //poll everyone, then execute, then respond - same order as Server.sync
+    struct ExecEntry {
+        Device*  Dev;
+        uint8_t  Channel;
+        IDHASH   Handler;
+        uint8_t  Params[64];
+        size_t   ParamsSize;
+        uint8_t  Response[32];
+        size_t   ResponseSize;
+        bool     Known;
+    };
+    static ExecEntry execQueue[SimBus::MAX_DEVICES * 8];
+    size_t execCount = 0;
+
+    if (m_DeviceCount) {
+        SimClientSocket(m_Bus, SimBus::GENERAL_CALL_ADDRESS, &m_Stats.NotReadyReads).ProbeStatus();
+    }
+    for (size_t i = 0; i < m_DeviceCount; i++) {
+        Device* dev = &m_Devices[i];
+        int status = dev->Socket.ReadStatus();
+        if (status >= 0 && !(status & SimClientSocket::STATUS_REQUESTS_MASK)) {
+            continue;
+        }
+        uint8_t resp[SimClientSocket::MAX_PACKET_SIZE];
+        m_Stats.Polls++;
+        int size = dev->Socket.SendCommand(CMD_POLL, nullptr, 0, resp, sizeof(resp));
+        if (size < 1) {
+            m_Stats.BadPackets++;
+            continue;
+        }
+        uint8_t count = resp[0];
+        size_t pos = 1;
+        for (uint8_t r = 0; r < count && execCount < sizeof(execQueue) / sizeof(*execQueue); r++) {
+            //channel, opcode (or escape and hash), varint size
+            if (pos + 3 > (size_t) size) {
+                m_Stats.BadPackets++;
+                break;
+            }
+            ExecEntry* e = &execQueue[execCount];
+            e->Dev = dev;
+            e->Channel = resp[pos++];
+            uint8_t opcode = resp[pos++];
+            if (opcode == OPCODE_ESCAPE) {
+                if (pos + 4 > (size_t) size) {
+                    m_Stats.BadPackets++;
+                    break;
+                }
+                memcpy(&e->Handler, resp + pos, sizeof(e->Handler));
+                pos += sizeof(e->Handler);
+            }
+            else if (opcode < HANDLER_COUNT) {
+                e->Handler = HANDLERS[opcode];
+            }
+            else {
+                m_Stats.BadPackets++;
+                break;
+            }
+            size_t paramsSize;
+            size_t varintSize = ReadVarint(resp + pos, size - pos, &paramsSize);
+            if (!varintSize) {
+                m_Stats.BadPackets++;
+                break;
+            }
+            pos += varintSize;
+            execCount++;
+            e->ParamsSize = min(min((size_t) paramsSize, size - pos), sizeof(e->Params));
+            memcpy(e->Params, resp + pos, e->ParamsSize);
+            pos += paramsSize;
+            m_Stats.Requests++;
+        }
+    }
+
+    for (size_t i = 0; i < execCount; i++) {
+        ExecEntry* e = &execQueue[i];
+        e->Known = HandleRequest(e->Dev, e->Handler, e->Params, e->ParamsSize, e->Response, &e->ResponseSize);
+        if (!e->Known) {
+            fprintf(stderr, "Unknown request %08X from %02X\n", e->Handler, e->Dev->Socket.GetAddress());
+        }
+    }
+
+    for (size_t i = 0; i < execCount; i++) {
+        ExecEntry* e = &execQueue[i];
+        e->Dev->Socket.SendCommandResponse(CMD_RESPONSE, e->Channel, e->Response, e->ResponseSize);
+    }
+}
+
+size_t SimServer::WriteEventPacket(uint8_t* out, const SimEvent* events, size_t count) {
+    if (count == 1) {
+        out[0] = events[0].Id;
+        memcpy(out + 1, events[0].Data, events[0].DataSize);
+        return 1 + events[0].DataSize;
+    }
+    uint8_t* pos = out;
+    *(pos++) = count;
+    for (size_t i = 0; i < count; i++) {
+        *(pos++) = events[i].Id;
+        *(pos++) = events[i].DataSize;
+        memcpy(pos, events[i].Data, events[i].DataSize);
+        pos += events[i].DataSize;
+    }
+    return pos - out;
+}
+
+void SimServer::SendEvents(Device* dev, const SimEvent* events, size_t count, bool ack) {
+    uint8_t packet[1 + 16 * (2 + SimEvent::MAX_DATA)];
+    size_t size = WriteEventPacket(packet, events, count);
+    uint8_t cmd = count == 1 ? CMD_EVENT : CMD_EVENT_BATCH;
+    uint64_t before = m_Bus->GetStats().Transactions;
+    if (ack) {
+        uint8_t resp[8];
+        dev->Socket.SendCommand(cmd, packet, size, resp, sizeof(resp));
+    }
+    else {
+        dev->Socket.PostCommand(cmd | CMD_FLAG_NO_ACK, packet, size);
+    }
+    m_Stats.EventTransactions += m_Bus->GetStats().Transactions - before;
+}
+
+void SimServer::BroadcastEvents(const SimEvent* events, size_t count) {
+    uint8_t packet[1 + 16 * (2 + SimEvent::MAX_DATA)];
+    size_t size = WriteEventPacket(packet, events, count);
+    uint8_t cmd = (count == 1 ? CMD_EVENT : CMD_EVENT_BATCH) | CMD_FLAG_BROADCAST | CMD_FLAG_NO_ACK;
+    uint64_t before = m_Bus->GetStats().Transactions;
+    SimClientSocket(m_Bus, SimBus::GENERAL_CALL_ADDRESS, &m_Stats.NotReadyReads).PostCommand(cmd, packet, size);
+    m_Stats.EventTransactions += m_Bus->GetStats().Transactions - before;
+}
+
+void SimServer::DispatchEvents(const SimEvent* events, size_t count, bool ack) {
+    //same grouping as Bomb.dispatchEvents - one transaction per component, or one for all of them
+    static constexpr size_t MAX_EVENTS = 16;
+    count = min(count, MAX_EVENTS);
+    bool broadcast[MAX_EVENTS] {};
+    bool anyBroadcast = false;
+    uint64_t generalCallsBefore = m_Bus->GetStats().GeneralCalls;
+
+    for (size_t i = 0; i < count; i++) {
+        if (events[i].Id == bconf::TIMER_TICK) {
+            m_Stats.TicksDispatched++;
+        }
+    }
+
+    for (size_t d = 0; d < m_DeviceCount; d++) {
+        Device* dev = &m_Devices[d];
+        SimEvent accepted[MAX_EVENTS];
+        size_t acceptedCount = 0;
+        for (size_t i = 0; i < count; i++) {
+            if (dev->AcceptedEvents & (1ul << events[i].Id)) {
+                if (m_Broadcast && !ack) {
+                    broadcast[i] = true;
+                    anyBroadcast = true;
+                }
+                accepted[acceptedCount++] = events[i];
+            }
+        }
+        if ((!m_Broadcast || ack) && acceptedCount) {
+            SendEvents(dev, accepted, acceptedCount, ack);
+        }
+    }
+
+    if (anyBroadcast) {
+        SimEvent out[MAX_EVENTS];
+        size_t outCount = 0;
+        for (size_t i = 0; i < count; i++) {
+            if (broadcast[i]) {
+                out[outCount++] = events[i];
+            }
+        }
+        BroadcastEvents(out, outCount);
+    }
+    m_Stats.MaxDispatchBroadcasts = max(m_Stats.MaxDispatchBroadcasts, m_Bus->GetStats().GeneralCalls - generalCallsBefore);
+}
+
+void SimServer::DispatchEvent(uint8_t id, bool ack) {
+    SimEvent e {id, 0, {}};
+    DispatchEvents(&e, 1, ack);
+}
+
+void SimServer::Arm(int32_t timeLimitMs) {
+    m_TimerMs = timeLimitMs;
+    m_TimerScale = 1.0f;
+    m_SinceSyncMs = TIMER_SYNC_INTERVAL;
+    m_Strikes = 0;
+    SimEvent arm = MakeClockSyncEvent(bconf::ARM);
+    DispatchEvents(&arm, 1);
+}
+
+SimEvent SimServer::MakeClockSyncEvent(uint8_t id) {
+    //Bomb.clock_sync_params
+    SimEvent event {id, sizeof(int32_t) + sizeof(float), {}};
+    int32_t clock = m_TimerMs;
+    memcpy(event.Data, &clock, sizeof(clock));
+    memcpy(event.Data + sizeof(clock), &m_TimerScale, sizeof(m_TimerScale));
+    return event;
+}
+
+void SimServer::UpdateTimer(uint32_t elapsedMs) {
+    //Bomb.update_timer
+    int32_t lastTimer = m_TimerMs;
+    m_TimerMs -= (int32_t) (elapsedMs * m_TimerScale);
+    if (m_TimerMs < 0) {
+        m_TimerMs = 0;
+    }
+    m_SinceSyncMs += elapsedMs;
+
+    SimEvent events[2];
+    size_t count = 0;
+    if (m_TimerMs / 1000 != lastTimer / 1000) {
+        events[count++] = SimEvent{bconf::TIMER_TICK, 0, {}};
+    }
+    if (m_SinceSyncMs > TIMER_SYNC_INTERVAL) {
+        events[count++] = MakeClockSyncEvent(bconf::TIMER_SYNC);
+        m_SinceSyncMs = 0;
+    }
+    if (count) {
+        DispatchEvents(events, count, false);
+    }
+}
+
+void SimServer::AddStrike() {
+    m_Strikes++;
+    m_TimerScale = STRIKE_TO_TIMER_SCALE[min(m_Strikes, (uint8_t) (sizeof(STRIKE_TO_TIMER_SCALE) / sizeof(float) - 1))];
+    SimEvent events[] {
+        {bconf::STRIKE, 0, {}},
+        MakeClockSyncEvent(bconf::TIMER_SYNC)
+    };
+    DispatchEvents(events, 2);
+}
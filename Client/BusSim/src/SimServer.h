@@ -0,0 +1,178 @@
+#ifndef __SIMSERVER_H
+#define __SIMSERVER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "Common.h"
+#include "SimBus.h"
+
+/*
+C++ stand-in for Server/BombuhServer. Speaks the same protocol as server.py and plays
+the parts of bomb.py that generate bus traffic: the game timer, strikes and the request handlers.
+*/
+
+struct SimEvent {
+    static constexpr size_t MAX_DATA = 8;
+
+    uint8_t Id;
+    uint8_t DataSize;
+    uint8_t Data[MAX_DATA];
+};
+
+//ClientSocket in server.py
+class SimClientSocket {
+public:
+    static constexpr uint8_t COMM_MAGIC_START = 0xFE;
+    static constexpr uint8_t COMM_PADDING = 0xFF; //nothing written at all, what an idle bus reads as
+    static constexpr uint8_t STATUS_INVALID = 0x80; //otherwise the client answers with its status byte when it has nothing queued
+    static constexpr uint8_t STATUS_REQUESTS_MASK = 0x0F;
+    static constexpr uint8_t STATUS_PROBE = 0xEB; //broadcast before the status reads of a sync, see server.py
+    static constexpr int NOT_READY_RETRIES = 16;
+    //writes and reads of the rest of a packet are as long as the bus allows
+    static constexpr size_t HEAD_WINDOW_SIZE = 8; //first read of a packet, may hold the start of the next one
+    static constexpr size_t MAX_PACKET_SIZE = 1024;
+
+private:
+    SimBus*  m_Bus;
+    uint8_t  m_Address;
+
+    uint64_t* m_NotReadyReads;
+
+    //read past the end of the last packet
+    uint8_t  m_Rx[MAX_PACKET_SIZE + 3 + SimBus::MAX_READ_SIZE];
+    size_t   m_RxSize;
+
+    bool TakeRx(uint8_t* out, size_t size);
+
+public:
+    SimClientSocket() : m_Bus{nullptr}, m_Address{0}, m_NotReadyReads{nullptr}, m_RxSize{0} {}
+
+    SimClientSocket(SimBus* bus, uint8_t address, uint64_t* notReadyCounter) :
+        m_Bus{bus}, m_Address{address}, m_NotReadyReads{notReadyCounter}, m_RxSize{0} {}
+
+    inline uint8_t GetAddress() const {
+        return m_Address;
+    }
+
+    bool SendPacket(const uint8_t* content, size_t size);
+    int ReadPacket(uint8_t* buffer, size_t capacity);
+    int ReadStatus();
+    bool ProbeStatus();
+
+    int SendCommand(uint8_t cmd, const uint8_t* params, size_t paramsSize, uint8_t* response, size_t capacity);
+    bool PostCommand(uint8_t cmd, const uint8_t* params, size_t paramsSize);
+    bool SendCommandResponse(uint8_t cmd, uint8_t channel, const uint8_t* params, size_t paramsSize);
+};
+
+class SimServer {
+public:
+    static constexpr uint8_t CMD_POLL = 1;
+    static constexpr uint8_t CMD_RESPONSE = 2;
+    static constexpr uint8_t CMD_EVENT = 3;
+    static constexpr uint8_t CMD_HANDSHAKE = 4;
+    static constexpr uint8_t CMD_EVENT_BATCH = 5;
+    static constexpr uint8_t CMD_STATS = 6;
+
+    static constexpr uint8_t CMD_FLAG_BROADCAST = 0x40;
+    static constexpr uint8_t CMD_FLAG_NO_ACK = 0x80;
+
+    static constexpr IDHASH HANDSHAKE_CHECK_HASH = 708580220;
+
+    //the handlers we serve, in the order they are handed out as opcodes
+    static constexpr IDHASH GET_STRIKES = HASHID("GetStrikes");
+    static constexpr IDHASH ADD_STRIKE = HASHID("AddStrike");
+    static constexpr IDHASH OUTPUT_DEBUG_MESSAGE = HASHID("OutputDebugMessage");
+    static constexpr IDHASH ACK_READY_TO_ARM = HASHID("AckReadyToArm");
+    static constexpr IDHASH DEFUSE_COMPONENT = HASHID("DefuseComponent");
+    static constexpr IDHASH HANDLERS[] {GET_STRIKES, ADD_STRIKE, OUTPUT_DEBUG_MESSAGE, ACK_READY_TO_ARM, DEFUSE_COMPONENT};
+    static constexpr uint8_t HANDLER_COUNT = sizeof(HANDLERS) / sizeof(*HANDLERS);
+    static constexpr uint8_t OPCODE_ESCAPE = 0xFF;
+
+    static constexpr uint8_t SCAN_FIRST = 0x08;
+    static constexpr uint8_t SCAN_LAST = 0x77;
+
+    //CLOCK_RATES in server.py above the clock the bus starts at
+    static constexpr uint32_t CLOCK_RATES[] {100000, 400000};
+
+    static constexpr int TIMER_SYNC_INTERVAL = 5000;
+    static constexpr float STRIKE_TO_TIMER_SCALE[] {1.0f, 1.25f, 1.5f, 3.0f, 6.0f};
+
+    struct Device {
+        SimClientSocket Socket;
+        uint32_t AcceptedEvents;
+        uint32_t MaxClock;
+        uint8_t  ReportedErrors;
+
+        bool     Reported;
+        uint32_t ReportedTicks;
+        uint32_t ReportedEvents;
+    };
+
+    struct Stats {
+        uint64_t NotReadyReads;
+        uint64_t BadPackets;
+        uint64_t Requests;
+        uint64_t Polls;
+        uint64_t EventTransactions;
+        uint64_t TicksDispatched;
+        uint64_t MaxDispatchBroadcasts; //most general call writes a single DispatchEvents took
+    };
+
+private:
+    SimBus*  m_Bus;
+    bool     m_Broadcast;
+
+    Device   m_Devices[SimBus::MAX_DEVICES];
+    size_t   m_DeviceCount;
+
+    Stats    m_Stats;
+
+    int32_t  m_TimerMs;
+    float    m_TimerScale;
+    uint32_t m_SinceSyncMs;
+    uint8_t  m_Strikes;
+
+    bool HandleRequest(Device* dev, IDHASH handler, const uint8_t* params, size_t paramsSize, uint8_t* response, size_t* responseSize);
+
+    SimEvent MakeClockSyncEvent(uint8_t id);
+
+    void SendEvents(Device* dev, const SimEvent* events, size_t count, bool ack);
+    void BroadcastEvents(const SimEvent* events, size_t count);
+
+    static size_t ReadVarint(const uint8_t* data, size_t size, size_t* value);
+    static size_t WriteEventPacket(uint8_t* out, const SimEvent* events, size_t count);
+
+public:
+    SimServer(SimBus* bus, bool broadcast);
+
+    size_t Discover();
+    size_t ShakeHands(const char* request);
+    uint32_t NegotiateClock();
+
+    void Sync();
+
+    //the latency statistics of a device as read_client_stats in server.py gets them, printed to stderr
+    bool PrintClientStats(size_t index);
+
+    void DispatchEvents(const SimEvent* events, size_t count, bool ack = true);
+    void DispatchEvent(uint8_t id, bool ack = true);
+
+    void Arm(int32_t timeLimitMs);
+    void UpdateTimer(uint32_t elapsedMs);
+    void AddStrike();
+
+    inline size_t GetDeviceCount() const {
+        return m_DeviceCount;
+    }
+
+    inline const Device& GetDevice(size_t index) const {
+        return m_Devices[index];
+    }
+
+    inline const Stats& GetStats() const {
+        return m_Stats;
+    }
+};
+
+#endif
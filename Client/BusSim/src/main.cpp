@@ -0,0 +1,313 @@
+/*
+Simulated I2C bus benchmark.
+
+Forks one process per module, each running SimModule on its own address, and drives them with SimServer
+the way Bomb.update drives the real bus: update the timer, sync with every module, sleep 50 ms.
+Bus time is computed for the given I2C clock, so the numbers hold for real hardware and not for this host.
+
+Usage: BusSim [modules=<n>] [seconds=<game seconds>] [clock=<Hz>] [strike=<every n seconds, 0 = never>] [link=i2c|uart] [unicast] [negotiate] [sweep] [verbose]
+link=uart runs the modules on comm::UnixSocketTransport and times the bus as RS-485 at clock baud (default 250000).
+negotiate raises the I2C clock after the handshake to what the modules advertise.
+sweep runs 1, 2, 4, ... modules up to the given count.
+The checks of SimScenarios.h run first, and fail the run like a module that missed a tick.
+So does an event dispatch that takes more than one general call write.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "Arduino.h"
+#include "BombInterface.h"
+#include "ComponentMain.h"
+#include "UnixSocketTransport.h"
+#include "SimBus.h"
+#include "SimServer.h"
+#include "SimScenarios.h"
+
+static constexpr uint32_t UPDATE_INTERVAL_US = 50000; //time.sleep(0.05) in main.py
+static constexpr uint8_t FIRST_ADDRESS = 0x10;
+
+static const char* HANDSHAKE_REQUEST = "Chceš-li se propojit, pak pošli v odpověď, co nejkrásnějšího kdy spatřil tento svět.";
+
+struct BenchConfig {
+    size_t   Modules;
+    uint32_t Seconds;
+    uint32_t Clock;
+    uint32_t StrikeInterval;
+    SimBus::Link Link;
+    bool     Broadcast;
+    bool     Negotiate;
+    bool     Verbose;
+};
+
+struct BenchResult {
+    size_t   Modules;
+    uint32_t Clock;
+    double   GameSeconds;
+    SimBus::Stats Bus;
+    SimServer::Stats Server;
+    uint64_t Updates;
+    uint64_t TotalUpdateUs;
+    uint64_t MaxUpdateUs;
+    bool     AllDelivered;
+};
+
+static int AnalogValueForAddress(uint8_t address) {
+    //inverse of AddressObtainer::FromAnalogPin
+    long range = 0x77 - 0x8;
+    return (int) (((address - 0x8) * 1023L + range - 1) / range);
+}
+
+static size_t SpawnModules(const BenchConfig& cfg, SimBus* bus, int* fds, pid_t* pids) {
+    size_t count = 0;
+    for (size_t i = 0; i < cfg.Modules; i++) {
+        int sv[2];
+        if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv) < 0) {
+            perror("socketpair");
+            break;
+        }
+        fflush(stdout);
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("fork");
+            close(sv[0]);
+            close(sv[1]);
+            break;
+        }
+        if (pid == 0) {
+            for (size_t j = 0; j < count; j++) {
+                close(fds[j]);
+            }
+            close(sv[0]);
+            if (!cfg.Verbose) {
+                int devnull = open("/dev/null", O_WRONLY);
+                dup2(devnull, STDOUT_FILENO);
+                close(devnull);
+            }
+            native::SetAnalogValue(A6, AnalogValueForAddress(FIRST_ADDRESS + i));
+            int ret;
+            if (cfg.Link == SimBus::Link::UART) {
+                ComponentMain::GetInstance()->SetTransport(new comm::UnixSocketTransport(sv[1]));
+                ret = native::RunSketch(-1);
+            }
+            else {
+                ret = native::RunSketch(sv[1]);
+            }
+            fflush(stdout);
+            _exit(ret);
+        }
+        close(sv[1]);
+        fds[count] = sv[0];
+        pids[count] = pid;
+        bus->AttachDevice(sv[0]);
+        count++;
+    }
+    return count;
+}
+
+static bool RunBench(const BenchConfig& cfg, BenchResult* result) {
+    SimBus bus(cfg.Clock, cfg.Link);
+    SimServer srv(&bus, cfg.Broadcast);
+    int fds[SimBus::MAX_DEVICES];
+    pid_t pids[SimBus::MAX_DEVICES];
+
+    size_t spawned = SpawnModules(cfg, &bus, fds, pids);
+    size_t found = srv.Discover();
+    size_t shaken = srv.ShakeHands(HANDSHAKE_REQUEST);
+    if (found != spawned || shaken != spawned) {
+        fprintf(stderr, "Spawned %d modules, discovered %d, handshake with %d\n", (int) spawned, (int) found, (int) shaken);
+    }
+
+    if (cfg.Negotiate) {
+        srv.NegotiateClock();
+    }
+
+    srv.DispatchEvent(bconf::RESET);
+    srv.Arm(cfg.Seconds * 10000);
+
+    SimBus::Stats busBefore = bus.GetStats();
+    SimServer::Stats srvBefore = srv.GetStats();
+
+    *result = BenchResult{};
+    result->Modules = shaken;
+    result->Clock = bus.GetClock();
+
+    uint64_t simUs = 0;
+    uint64_t timerUs = 0;
+    uint64_t nextStrikeUs = cfg.StrikeInterval * 1000000ull;
+    while (simUs < cfg.Seconds * 1000000ull) {
+        uint64_t cyclesBefore = bus.GetStats().Cycles;
+
+        //Bomb.update
+        uint32_t elapsedMs = (simUs - timerUs) / 1000;
+        timerUs += elapsedMs * 1000ull;
+        srv.UpdateTimer(elapsedMs);
+        if (cfg.StrikeInterval && simUs >= nextStrikeUs) {
+            //as if a module had sent AddStrike
+            srv.AddStrike();
+            nextStrikeUs += cfg.StrikeInterval * 1000000ull;
+        }
+        srv.Sync();
+
+        uint64_t updateUs = bus.CyclesToMicros(bus.GetStats().Cycles - cyclesBefore);
+        result->Updates++;
+        result->TotalUpdateUs += updateUs;
+        result->MaxUpdateUs = max(result->MaxUpdateUs, updateUs);
+        simUs += updateUs + UPDATE_INTERVAL_US;
+    }
+    result->GameSeconds = simUs / 1e6;
+
+    const SimBus::Stats& busAfter = bus.GetStats();
+    result->Bus.Transactions = busAfter.Transactions - busBefore.Transactions;
+    result->Bus.Bytes = busAfter.Bytes - busBefore.Bytes;
+    result->Bus.Cycles = busAfter.Cycles - busBefore.Cycles;
+    result->Bus.Nacks = busAfter.Nacks - busBefore.Nacks;
+
+    const SimServer::Stats& srvAfter = srv.GetStats();
+    result->Server.NotReadyReads = srvAfter.NotReadyReads - srvBefore.NotReadyReads;
+    result->Server.BadPackets = srvAfter.BadPackets - srvBefore.BadPackets;
+    result->Server.Requests = srvAfter.Requests - srvBefore.Requests;
+    result->Server.Polls = srvAfter.Polls - srvBefore.Polls;
+    result->Server.EventTransactions = srvAfter.EventTransactions - srvBefore.EventTransactions;
+    result->Server.TicksDispatched = srvAfter.TicksDispatched;
+    result->Server.MaxDispatchBroadcasts = srvAfter.MaxDispatchBroadcasts;
+
+    if (cfg.Verbose && srv.GetDeviceCount()) {
+        srv.PrintClientStats(0);
+    }
+
+    //every module has to have seen every tick, broadcast or not
+    srv.DispatchEvent(bconf::DEFUSAL);
+    srv.Sync();
+    result->AllDelivered = shaken == cfg.Modules;
+    for (size_t i = 0; i < srv.GetDeviceCount(); i++) {
+        const SimServer::Device& dev = srv.GetDevice(i);
+        if (!dev.Reported || dev.ReportedTicks != srvAfter.TicksDispatched) {
+            fprintf(stderr, "Module %02X received %lu of %lu ticks%s\n", dev.Socket.GetAddress(),
+                (unsigned long) dev.ReportedTicks, (unsigned long) srvAfter.TicksDispatched, dev.Reported ? "" : " (no report)");
+            result->AllDelivered = false;
+        }
+    }
+
+    //the events of a dispatch go to every module in one write, or in none when they are unicast
+    bool oneBroadcast = result->Server.MaxDispatchBroadcasts <= 1;
+    if (!oneBroadcast) {
+        fprintf(stderr, "An event dispatch took %lu general call writes\n", (unsigned long) result->Server.MaxDispatchBroadcasts);
+    }
+
+    for (size_t i = 0; i < spawned; i++) {
+        close(fds[i]);
+    }
+    for (size_t i = 0; i < spawned; i++) {
+        waitpid(pids[i], nullptr, 0);
+    }
+    return result->AllDelivered && oneBroadcast;
+}
+
+static void PrintHeader() {
+    printf("%7s %7s %10s %9s %9s %9s %8s %8s %8s %9s %9s %8s %s\n",
+        "modules", "clock", "bytes/s", "trans/s", "evtrans/s", "polls/s", "bus %", "upd avg", "upd max", "poll lat", "notready", "bad", "delivery");
+}
+
+static void PrintResult(const BenchResult& r) {
+    double s = r.GameSeconds;
+    uint64_t busUs = SimBus(r.Clock).CyclesToMicros(r.Bus.Cycles);
+    printf("%7d %6luk %10.0f %9.1f %9.1f %9.1f %7.1f%% %6.2fms %6.2fms %7.2fms %9lu %8lu %s\n",
+        (int) r.Modules,
+        (unsigned long) r.Clock / 1000,
+        r.Bus.Bytes / s,
+        r.Bus.Transactions / s,
+        r.Server.EventTransactions / s,
+        r.Server.Polls / s,
+        100.0 * busUs / (s * 1e6),
+        r.Updates ? r.TotalUpdateUs / 1000.0 / r.Updates : 0.0,
+        r.MaxUpdateUs / 1000.0,
+        //a request queued right after its module was polled waits for the rest of this update, the sleep and the next one
+        (UPDATE_INTERVAL_US + 2 * r.MaxUpdateUs) / 1000.0,
+        (unsigned long) r.Server.NotReadyReads,
+        (unsigned long) r.Server.BadPackets,
+        r.AllDelivered ? "ok" : "FAILED");
+    fflush(stdout);
+}
+
+int main(int argc, char** argv) {
+    BenchConfig cfg {8, 60, 0, 20, SimBus::Link::I2C, true, false, false};
+    bool sweep = false;
+    for (int i = 1; i < argc; i++) {
+        unsigned long value;
+        if (sscanf(argv[i], "modules=%lu", &value) == 1) {
+            cfg.Modules = min(value, (unsigned long) (0x77 - FIRST_ADDRESS + 1));
+        }
+        else if (sscanf(argv[i], "seconds=%lu", &value) == 1) {
+            cfg.Seconds = value;
+        }
+        else if (sscanf(argv[i], "clock=%lu", &value) == 1) {
+            cfg.Clock = value;
+        }
+        else if (sscanf(argv[i], "strike=%lu", &value) == 1) {
+            cfg.StrikeInterval = value;
+        }
+        else if (!strcmp(argv[i], "link=i2c")) {
+            cfg.Link = SimBus::Link::I2C;
+        }
+        else if (!strcmp(argv[i], "link=uart")) {
+            cfg.Link = SimBus::Link::UART;
+        }
+        else if (!strcmp(argv[i], "unicast")) {
+            cfg.Broadcast = false;
+        }
+        else if (!strcmp(argv[i], "negotiate")) {
+            cfg.Negotiate = true;
+        }
+        else if (!strcmp(argv[i], "sweep")) {
+            sweep = true;
+        }
+        else if (!strcmp(argv[i], "verbose")) {
+            cfg.Verbose = true;
+        }
+        else {
+            fprintf(stderr, "Unknown argument %s\n", argv[i]);
+            return 2;
+        }
+    }
+
+    if (!cfg.Clock) {
+        cfg.Clock = cfg.Link == SimBus::Link::UART ? 250000 : 28800;
+    }
+    if (cfg.Link == SimBus::Link::UART) {
+        cfg.Negotiate = false; //the clock rates are those of I2C
+    }
+
+    printf("%s %lu %s, %lu game seconds, strike every %lu s, events %s\n",
+        cfg.Link == SimBus::Link::UART ? "RS-485" : "I2C clock", (unsigned long) cfg.Clock, cfg.Link == SimBus::Link::UART ? "baud" : "Hz", (unsigned long) cfg.Seconds, (unsigned long) cfg.StrikeInterval, cfg.Broadcast ? "broadcast" : "unicast");
+    bool ok = scenario::RunAll(cfg.Link);
+    PrintHeader();
+
+    size_t overrunAt = 0;
+    size_t worstOverrunAt = 0;
+    size_t maxModules = cfg.Modules;
+    for (size_t n = sweep ? 1 : maxModules; n <= maxModules; n = (n * 2 > maxModules && n != maxModules) ? maxModules : n * 2) {
+        BenchConfig run = cfg;
+        run.Modules = n;
+        BenchResult result;
+        ok &= RunBench(run, &result);
+        PrintResult(result);
+        if (!overrunAt && result.Updates && result.TotalUpdateUs / result.Updates > UPDATE_INTERVAL_US) {
+            overrunAt = n;
+        }
+        if (!worstOverrunAt && result.MaxUpdateUs > UPDATE_INTERVAL_US) {
+            worstOverrunAt = n;
+        }
+    }
+    if (worstOverrunAt) {
+        printf("The busiest update takes longer than the %lu ms update interval from %d modules.\n", (unsigned long) UPDATE_INTERVAL_US / 1000, (int) worstOverrunAt);
+    }
+    if (overrunAt) {
+        printf("The average update takes longer than the %lu ms update interval from %d modules.\n", (unsigned long) UPDATE_INTERVAL_US / 1000, (int) overrunAt);
+    }
+    return ok ? 0 : 1;
+}
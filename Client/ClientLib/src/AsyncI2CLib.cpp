@@ -5,34 +5,130 @@
 #include <stddef.h>
 #include "lambda.h"
 #include <alloca.h>
+#include "CriticalSection.h"
 #include "DebugPrint.h"
 #include "Promise.h"
 #include "AsyncI2CLib.h"
-#include "Wire.h"
+#include "I2CTransport.h"
 
 namespace comm {
+
+    I2CReceiveArena::I2CReceiveArena() : m_Head{0}, m_Tail{0}, m_WrapPos{0}, m_Wrapped{false} {
+
+    }
+
+    void* I2CReceiveArena::Alloc(size_t size) {
+        size_t span = BlockSpan(size);
+        size_t offset;
+        if (span > SIZE) {
+            return nullptr;
+        }
+        if (!m_Wrapped) {
+            if (SIZE - m_Head >= span) {
+                offset = m_Head;
+            }
+            else if (span < m_Tail) {
+                //not enough space at the end, continue from the start of the ring
+                m_WrapPos = m_Head;
+                m_Wrapped = true;
+                offset = 0;
+            }
+            else {
+                return nullptr;
+            }
+        }
+        else {
+            if (m_Tail - m_Head > span) {
+                offset = m_Head;
+            }
+            else {
+                return nullptr;
+            }
+        }
+        Block* b = BlockAt(offset);
+        b->Size = size;
+        b->InUse = true;
+        m_Head = offset + span;
+        DEBUG_PRINTF_P("Arena alloc %d bytes at %d.\n", size, offset)
+        return m_Data + offset + HEADER_SIZE;
+    }
+
+    void I2CReceiveArena::Release(void* buffer) {
+        size_t offset = static_cast<char*>(buffer) - m_Data - HEADER_SIZE;
+        Block* released = BlockAt(offset);
+        released->InUse = false;
+        if (offset + BlockSpan(released->Size) == m_Head) {
+            //the newest block, as when a packet is refused as soon as it is in, is free again right away
+            m_Head = offset;
+        }
+        while (true) {
+            if (m_Wrapped && m_Tail == m_WrapPos) {
+                m_Tail = 0;
+                m_Wrapped = false;
+            }
+            if (!m_Wrapped && m_Tail == m_Head) {
+                //ring is empty, rewind so that the next block gets the whole arena
+                m_Tail = 0;
+                m_Head = 0;
+                break;
+            }
+            Block* b = BlockAt(m_Tail);
+            if (b->InUse) {
+                break;
+            }
+            m_Tail += BlockSpan(b->Size);
+        }
+    }
+
+    bool I2CReceiveArena::Owns(const void* buffer) {
+        const char* p = static_cast<const char*>(buffer);
+        return p >= m_Data && p < m_Data + SIZE;
+    }
     
-    I2CReadPromiseQueue::I2CReadPromiseQueue() {
+    I2CReadPromiseQueue::EntryPool I2CReadPromiseQueue::s_EntryPool;
+
+    I2CReadPromiseQueue::I2CReadPromiseQueue(I2CReceiveArena* arena) {
         m_Head = nullptr;
+        m_Dropped = nullptr;
+        m_Arena = arena;
+        m_ArenaDrops = 0;
     }
 
     bool I2CReadPromiseQueue::IsEmpty() {
         return m_Head == nullptr;
     }
 
-    void I2CReadPromiseQueue::Insert(Promise* promise, size_t readSize, ReadLocation readType, void* readPointer) {
+    void I2CReadPromiseQueue::Insert(ContinuationBase* cont, size_t readSize, ReadLocation readType, void* readPointer) {
         Entry* entry = new Entry();
-        entry->m_Promise = promise;
+        if (!entry) {
+            PRINTF_P("Read queue full, dropping %d bytes!\n", (int) readSize);
+            cont->Cancel();
+            return;
+        }
+        if (readType == ReadLocation::HEAP) {
+            //here rather than in ReadInto, which runs in the interrupt
+            readPointer = malloc(readSize);
+            if (!readPointer) {
+                readType = ReadLocation::DISCARD;
+            }
+        }
+        entry->m_Continuation = cont;
         entry->m_Next = m_Head;
         entry->m_RemainingSize = readSize;
         entry->m_ReadLoc = readType;
         entry->m_ReadBuffer = (char*)readPointer;
         entry->m_ReadBufferPos = entry->m_ReadBuffer;
+        entry->m_LastProgress = millis();
         m_Head = entry;
-        DEBUG_PRINTF_P("Promising %d bytes to promise %p.\n", readSize, promise)
+        DEBUG_PRINTF_P("Promising %d bytes to continuation %p.\n", readSize, cont)
     }
 
-    size_t I2CReadPromiseQueue::ReadInto(size_t limit) {
+    uint16_t I2CReadPromiseQueue::GetArenaDrops() {
+        CriticalSection cs;
+        return m_ArenaDrops;
+    }
+
+    size_t I2CReadPromiseQueue::ReadInto(Transport* link, size_t limit) {
         DEBUG_PRINTF_P("Distributing %d bytes to promises.\n", limit)
         size_t read = 0;
 
@@ -48,13 +144,18 @@ namespace comm {
                 }
 
                 switch (e->m_ReadLoc) {
-                    case ReadLocation::HEAP:
-                    case ReadLocation::TEMP_HEAP:
-                        e->m_ReadBuffer = (char*)malloc(e->m_RemainingSize);
-                        break;
                     case ReadLocation::STACK:
                         e->m_ReadBuffer = (char*)alloca(e->m_RemainingSize);
                         break;
+                    case ReadLocation::TEMP_HEAP:
+                    case ReadLocation::ARENA:
+                        e->m_ReadBuffer = (char*)m_Arena->Alloc(e->m_RemainingSize);
+                        if (!e->m_ReadBuffer) {
+                            PRINTF_P("Receive arena full, dropping %d bytes!\n", (int) e->m_RemainingSize);
+                            e->m_ReadLoc = ReadLocation::DISCARD;
+                            m_ArenaDrops++;
+                        }
+                        break;
                     default:
                         break;
                 }
@@ -64,20 +165,30 @@ namespace comm {
             if (myLimit > e->m_RemainingSize) {
                 myLimit = e->m_RemainingSize;
             }
-            size_t hwread = Wire.readBytes(e->m_ReadBufferPos, myLimit);
+            size_t hwread;
+            if (e->m_ReadLoc == ReadLocation::DISCARD) {
+                for (hwread = 0; hwread < myLimit; hwread++) {
+                    link->Read();
+                }
+            }
+            else {
+                hwread = link->Read(e->m_ReadBufferPos, myLimit);
+            }
             DEBUG_PRINTF_P("In promise: read %d bytes.\n", hwread)
             e->m_ReadBufferPos += hwread;
             e->m_RemainingSize -= hwread;
+            e->m_LastProgress = millis();
             limit -= hwread;
 
             if (!e->m_RemainingSize) {
                 m_Head = e->m_Next;
-                DEBUG_PRINTF_P("Resolving read promise %p...\n", e->m_Promise)
-                e->m_Promise->Resolve(e->m_ReadBuffer);
-                DEBUG_PRINTLN("Promise resolved!")
+                DEBUG_PRINTF_P("Resuming read continuation %p...\n", e->m_Continuation)
+                e->m_Continuation->Resume(e->m_ReadBuffer);
+                DEBUG_PRINTLN("Continuation resumed!")
 
                 if (e->m_ReadLoc == ReadLocation::TEMP_HEAP) {
-                    delete[] e->m_ReadBuffer;
+                    CriticalSection cs;
+                    m_Arena->Release(e->m_ReadBuffer);
                 }
 
                 delete e;
@@ -92,39 +203,204 @@ namespace comm {
         return read;
     }
 
+    I2CWritePromiseQueue::EntryPool I2CWritePromiseQueue::s_EntryPool;
+
+    I2CReadPromiseQueue::Entry* I2CReadPromiseQueue::Detach(uint16_t now, uint16_t timeout) {
+        //the head is the read in progress, the ones behind it are what its continuation queued
+        CriticalSection cs;
+        Entry* e = m_Head;
+        if (e && (!timeout || (uint16_t) (now - e->m_LastProgress) > timeout)) {
+            m_Head = nullptr;
+            return e;
+        }
+        return nullptr;
+    }
+
+    size_t I2CReadPromiseQueue::ReleaseReadBuffer(Entry* e) {
+        if (!e->m_ReadBuffer) {
+            return 0;
+        }
+        size_t size = (e->m_ReadBufferPos - e->m_ReadBuffer) + e->m_RemainingSize;
+        switch (e->m_ReadLoc) {
+            case ReadLocation::HEAP:
+                free(e->m_ReadBuffer);
+                return size;
+            case ReadLocation::TEMP_HEAP:
+            case ReadLocation::ARENA: {
+                CriticalSection cs;
+                m_Arena->Release(e->m_ReadBuffer);
+                return size;
+            }
+            default:
+                return 0; //the caller's, or on a stack long gone
+        }
+    }
+
+    void I2CReadPromiseQueue::DropAll() {
+        CriticalSection cs;
+        if (!m_Head) {
+            return;
+        }
+        //behind whatever an earlier reset left, if the main loop has not got to it yet
+        Entry** tail = &m_Dropped;
+        while (*tail) {
+            tail = &(*tail)->m_Next;
+        }
+        *tail = m_Head;
+        m_Head = nullptr;
+    }
+
+    I2CReadPromiseQueue::Entry* I2CReadPromiseQueue::TakeDropped() {
+        CriticalSection cs;
+        Entry* e = m_Dropped;
+        m_Dropped = nullptr;
+        return e;
+    }
+
+    size_t I2CReadPromiseQueue::Cancel(Entry* e, uint8_t* count) {
+        size_t reclaimed = 0;
+        while (e) {
+            Entry* next = e->m_Next;
+            reclaimed += ReleaseReadBuffer(e);
+            if (e->m_Continuation) {
+                e->m_Continuation->Cancel();
+            }
+            delete e;
+            (*count)++;
+            e = next;
+        }
+        return reclaimed;
+    }
+
     I2CWritePromiseQueue::I2CWritePromiseQueue() {
         m_Head = nullptr;
+        m_Tail = nullptr;
+        m_Dropped = nullptr;
+        m_StaticEntriesUsed = 0;
     }
 
-    void I2CWritePromiseQueue::Insert(Promise* promise, void* data, size_t size) {
-        Entry* entry = new Entry();
-        entry->m_Promise = promise;
-        entry->m_Next = m_Head;
+    void I2CWritePromiseQueue::InitEntry(Entry* entry, ContinuationBase* cont, const void* data, size_t size, bool startsPacket) {
+        entry->m_Continuation = cont;
         entry->m_RemainingSize = size;
+        entry->m_StartsPacket = startsPacket;
         entry->m_WriteBuffer = (char*)data;
         entry->m_WriteBufferPos = entry->m_WriteBuffer;
-        m_Head = entry;
-        DEBUG_PRINTF_P("Promising to write %d bytes to %p.\n", size, promise)            
+        entry->m_LastProgress = millis();
+        entry->m_Next = nullptr;
+    }
+
+    I2CWritePromiseQueue::Entry* I2CWritePromiseQueue::ClaimStaticEntry() {
+        {
+            CriticalSection cs; //released by the interrupt once written out
+            for (size_t i = 0; i < STATIC_ENTRY_LIMIT; i++) {
+                if (!(m_StaticEntriesUsed & (1 << i))) {
+                    m_StaticEntriesUsed |= (1 << i);
+                    return &m_StaticEntries[i];
+                }
+            }
+        }
+        return new Entry();
+    }
+
+    void I2CWritePromiseQueue::Append(Entry* first, Entry* last) {
+        //first in, first out - consecutive writes may share a request
+        CriticalSection cs; //the tail may be written out and released under us
+        if (m_Tail) {
+            m_Tail->m_Next = first;
+        }
+        else {
+            m_Head = first;
+        }
+        m_Tail = last;
     }
 
-    size_t I2CWritePromiseQueue::WriteOut() { //only one response at a time
-        if (m_Head) {
+    void I2CWritePromiseQueue::Insert(ContinuationBase* cont, void* data, size_t size, bool startsPacket) {
+        Entry* entry = new Entry();
+        if (!entry) {
+            PRINTF_P("Write queue full, dropping %d bytes!\n", (int) size);
+            cont->Cancel();
+            return;
+        }
+        InitEntry(entry, cont, data, size, startsPacket);
+        Append(entry, entry);
+        DEBUG_PRINTF_P("Promising to write %d bytes to %p.\n", size, cont)            
+    }
+
+    void I2CWritePromiseQueue::InsertStatic(const void* data, size_t size, bool startsPacket) {
+        Entry* entry = ClaimStaticEntry();
+        if (!entry) {
+            PRINTF_P("Write queue full, dropping %d bytes!\n", (int) size);
+            return;
+        }
+        InitEntry(entry, nullptr, data, size, startsPacket);
+        Append(entry, entry);
+    }
+
+    void I2CWritePromiseQueue::InsertPacket(ContinuationBase* cont, const void* prolog, size_t prologSize, void* data, size_t size) {
+        //both go in at once - a request in between would get the prolog and padding for the contents
+        Entry* head = ClaimStaticEntry();
+        Entry* contents = new Entry();
+        if (!head || !contents) {
+            PRINTF_P("Write queue full, dropping %d bytes!\n", (int) (prologSize + size));
+            if (head) {
+                ReleaseEntry(head);
+            }
+            if (contents) {
+                delete contents;
+            }
+            cont->Cancel();
+            return;
+        }
+        InitEntry(head, nullptr, prolog, prologSize, true);
+        InitEntry(contents, cont, data, size, false);
+        head->m_Next = contents;
+        Append(head, contents);
+        DEBUG_PRINTF_P("Promising to write a packet of %d bytes to %p.\n", size, cont)
+    }
+
+    void I2CWritePromiseQueue::ReleaseEntry(Entry* e) {
+        if (e >= m_StaticEntries && e < m_StaticEntries + STATIC_ENTRY_LIMIT) {
+            CriticalSection cs;
+            m_StaticEntriesUsed &= ~(1 << (e - m_StaticEntries));
+        }
+        else {
+            delete e;
+        }
+    }
+
+    bool I2CWritePromiseQueue::IsEmpty() {
+        return m_Head == nullptr;
+    }
+
+    size_t I2CWritePromiseQueue::WriteOut(Transport* link) {
+        size_t written = 0;
+        bool head = m_Head && m_Head->m_StartsPacket && m_Head->m_WriteBufferPos == m_Head->m_WriteBuffer;
+        size_t window = link->GetRequestSize();
+        if (head && window > WRITE_HEAD_WINDOW) {
+            window = WRITE_HEAD_WINDOW;
+        }
+        while (m_Head && written < window) {
             Entry* e = m_Head;
+            if (written && e->m_StartsPacket && (!head || window - written < PACKET_PROLOG_SIZE)) {
+                break;
+            }
             DEBUG_PRINTF_P("Writing %d of promised packet data.\n", e->m_RemainingSize)
             #ifdef DEBUG
             char* startBufPos = e->m_WriteBufferPos;
             #endif
             size_t wreq = e->m_RemainingSize;
-            if (wreq > 32) {
-                wreq = 32;
+            if (wreq > window - written) {
+                wreq = window - written;
             }
-            size_t written = Wire.write(e->m_WriteBufferPos, wreq);
-            e->m_WriteBufferPos += written;
-            e->m_RemainingSize -= written;
-            DEBUG_PRINTF_P("Wrote %d\n", written);
+            size_t entryWritten = wreq ? link->Write(e->m_WriteBufferPos, wreq) : 0;
+            e->m_WriteBufferPos += entryWritten;
+            e->m_RemainingSize -= entryWritten;
+            e->m_LastProgress = millis();
+            written += entryWritten;
+            DEBUG_PRINTF_P("Wrote %d\n", entryWritten);
             #ifdef DEBUG
             Serial.print("{");
-            for (size_t i = 0; i < written; i++) {
+            for (size_t i = 0; i < entryWritten; i++) {
                 if (i) {
                     Serial.print(", ");
                 }
@@ -132,36 +408,138 @@ namespace comm {
             }
             Serial.println("}");
             #endif
-            if (e->m_RemainingSize == 0) {
-                m_Head = e->m_Next;
-                DEBUG_PRINTF_P("Resolving write promise %p...\n", e->m_Promise)
-                e->m_Promise->Resolve(e->m_WriteBufferPos);
-                DEBUG_PRINTLN("Resolved!");
-                delete e;
+            if (e->m_RemainingSize) {
+                break;
+            }
+            m_Head = e->m_Next;
+            if (!m_Head) {
+                m_Tail = nullptr;
             }
-            return written;
+            if (e->m_Continuation) {
+                DEBUG_PRINTF_P("Resuming write continuation %p...\n", e->m_Continuation)
+                e->m_Continuation->Resume(e->m_WriteBufferPos);
+                DEBUG_PRINTLN("Resumed!");
+            }
+            ReleaseEntry(e);
         }
-        return 0;
+        return written;
     }
 
-    AsyncI2C::AsyncI2C() : m_ReadQueue(), m_WriteQueue() {
+    I2CWritePromiseQueue::Entry* I2CWritePromiseQueue::Detach(uint16_t now, uint16_t timeout) {
+        CriticalSection cs;
+        Entry* e = m_Head;
+        if (e && (!timeout || (uint16_t) (now - e->m_LastProgress) > timeout)) {
+            m_Head = nullptr;
+            m_Tail = nullptr;
+            return e;
+        }
+        return nullptr;
+    }
+
+    void I2CWritePromiseQueue::DropAll() {
+        CriticalSection cs;
+        if (!m_Head) {
+            return;
+        }
+        Entry** tail = &m_Dropped;
+        while (*tail) {
+            tail = &(*tail)->m_Next;
+        }
+        *tail = m_Head;
+        m_Head = nullptr;
+        m_Tail = nullptr;
+    }
 
+    I2CWritePromiseQueue::Entry* I2CWritePromiseQueue::TakeDropped() {
+        CriticalSection cs;
+        Entry* e = m_Dropped;
+        m_Dropped = nullptr;
+        return e;
+    }
+
+    size_t I2CWritePromiseQueue::Cancel(Entry* e, uint8_t* count) {
+        size_t reclaimed = 0;
+        while (e) {
+            Entry* next = e->m_Next;
+            if (e->m_Continuation) {
+                //whoever waits for the write owns the data, it is theirs to free
+                reclaimed += (e->m_WriteBufferPos - e->m_WriteBuffer) + e->m_RemainingSize;
+                e->m_Continuation->Cancel();
+            }
+            ReleaseEntry(e);
+            (*count)++;
+            e = next;
+        }
+        return reclaimed;
+    }
+
+    AsyncI2C::AsyncI2C() : m_Link{I2CTransport::GetInstance()}, m_Arena(), m_ReadQueue(&m_Arena), m_WriteQueue(),
+        m_ReclaimedBytes{0}, m_CancelledTransfers{0} {
+
+    }
+
+    void AsyncI2C::CountCancelled(size_t bytes, uint8_t count) {
+        if (!count) {
+            return;
+        }
+        PRINTF_P("Cancelled %u transfers, %u bytes reclaimed\n", (unsigned int) count, (unsigned int) bytes);
+        CriticalSection cs;
+        m_ReclaimedBytes += bytes;
+        m_CancelledTransfers += count;
+    }
+
+    bool AsyncI2C::ExpireTransfers() {
+        uint8_t count = 0;
+        size_t bytes = m_ReadQueue.Cancel(m_ReadQueue.TakeDropped(), &count);
+        bytes += m_WriteQueue.Cancel(m_WriteQueue.TakeDropped(), &count);
+    #if ASYNCI2C_TRANSFER_TIMEOUT
+        uint16_t now = millis();
+        bytes += m_ReadQueue.Cancel(m_ReadQueue.Detach(now, ASYNCI2C_TRANSFER_TIMEOUT), &count);
+        bytes += m_WriteQueue.Cancel(m_WriteQueue.Detach(now, ASYNCI2C_TRANSFER_TIMEOUT), &count);
+    #endif
+        CountCancelled(bytes, count);
+        return count;
+    }
+
+    void AsyncI2C::Reset() {
+        m_ReadQueue.DropAll();
+        m_WriteQueue.DropAll();
     }
 
     bool AsyncI2C::IsReceiving() {
         return !m_ReadQueue.IsEmpty();
     }
 
+    bool AsyncI2C::IsSending() {
+        return !m_WriteQueue.IsEmpty();
+    }
+
     size_t AsyncI2C::HandleReceive(size_t size) {
-        size_t s = m_ReadQueue.ReadInto(size);
+        size_t s = m_ReadQueue.ReadInto(m_Link, size);
         DEBUG_PRINTF_P("Consumed %d bytes in read promises.\n", s)
         return s;
     }
 
     void AsyncI2C::HandleRequest() {
-        m_WriteQueue.WriteOut();
+        m_WriteQueue.WriteOut(m_Link);
     }
     
+    void AsyncI2C::Read(ContinuationBase* cont, size_t size, ReadLocation bufferLocation) {
+        m_ReadQueue.Insert(cont, size, bufferLocation);
+    }
+
+    void AsyncI2C::ReadTemp(ContinuationBase* cont, size_t size) {
+        m_ReadQueue.Insert(cont, size, ReadLocation::STACK);
+    }
+
+    void AsyncI2C::ReadInto(ContinuationBase* cont, size_t size, void* dest) {
+        m_ReadQueue.Insert(cont, size, ReadLocation::DEFINED, dest);
+    }
+
+    void AsyncI2C::Write(ContinuationBase* cont, void* data, size_t size, bool startsPacket) {
+        m_WriteQueue.Insert(cont, data, size, startsPacket);
+    }
+
     Promise* AsyncI2C::Read(void* context, size_t size, ReadLocation bufferLocation) {
         Promise* promise = new Promise(context);
         m_ReadQueue.Insert(promise, size, bufferLocation);
@@ -180,9 +558,30 @@ namespace comm {
         return promise;
     }
 
-    Promise* AsyncI2C::Write(void* context, void* data, size_t size) {
+    Promise* AsyncI2C::Write(void* context, void* data, size_t size, bool startsPacket) {
         Promise* promise = new Promise(context);
-        m_WriteQueue.Insert(promise, data, size);
+        m_WriteQueue.Insert(promise, data, size, startsPacket);
         return promise;
     }
+
+    void AsyncI2C::WriteStatic(const void* data, size_t size, bool startsPacket) {
+        m_WriteQueue.InsertStatic(data, size, startsPacket);
+    }
+
+    void AsyncI2C::WritePacket(ContinuationBase* cont, const void* prolog, size_t prologSize, void* data, size_t size) {
+        m_WriteQueue.InsertPacket(cont, prolog, prologSize, data, size);
+    }
+
+    void AsyncI2C::ReleaseBuffer(void* buffer) {
+        if (m_Arena.Owns(buffer)) {
+            m_Arena.Release(buffer);
+        }
+        else {
+            free(buffer);
+        }
+    }
+
+    size_t AsyncI2C::GetBufferSize(const void* buffer) {
+        return m_Arena.Owns(buffer) ? m_Arena.GetSize(buffer) : 0;
+    }
 }
\ No newline at end of file
@@ -2,64 +2,222 @@
 #define __ASYNCI2CLIB_H
 
 #include <stddef.h>
+#include <stdint.h>
 #include <new>
 #include "lambda.h"
 #include <alloca.h>
 #include "DebugPrint.h"
+#include "Continuation.h"
 #include "Promise.h"
+#include "BlockPool.h"
+#include "Transport.h"
+
+//Holds every packet received until ProcessCommands is done with it, the largest being the bomb configuration
+#ifndef ASYNCI2C_RECEIVE_ARENA_SIZE
+#define ASYNCI2C_RECEIVE_ARENA_SIZE 256
+#endif
+
+//A transfer that has not moved a byte for this many ms is cancelled by ExpireTransfers, 0 to wait forever
+#ifndef ASYNCI2C_TRANSFER_TIMEOUT
+#define ASYNCI2C_TRANSFER_TIMEOUT 1000
+#endif
+
+//Pending reads and writes, each. Entries are taken in the interrupt, so there is no heap fallback:
+//a transfer that finds the pool empty is dropped and its continuation cancelled.
+#ifndef ASYNCI2C_ENTRY_POOL_SIZE
+#define ASYNCI2C_ENTRY_POOL_SIZE 4
+#endif
 
 namespace comm {
 
     enum class ReadLocation {
-        STACK,
-        TEMP_HEAP,
-        HEAP,
-        DEFINED
+        STACK,     //on the stack of the interrupt, or TEMP_HEAP if it does not all come in one go
+        TEMP_HEAP, //a receive arena block (despite the name), released as soon as the continuation returns
+        HEAP,      //malloc'd when the read is queued, so queue it from the main loop; the continuation owns it
+        DEFINED,
+        ARENA,
+        DISCARD
+    };
+
+    class I2CReceiveArena {
+        //Fixed ring of receive buffers, allocated from the I2C ISR and released from the main loop.
+        //Blocks are normally released in the order they were received, but out-of-order release is tolerated.
+    public:
+        static constexpr size_t SIZE = ASYNCI2C_RECEIVE_ARENA_SIZE;
+
+    private:
+        struct Block {
+            uint16_t Size;
+            bool     InUse;
+        };
+
+        static constexpr size_t ALIGNMENT = alignof(max_align_t);
+        static constexpr size_t HEADER_SIZE = (sizeof(Block) + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+
+        alignas(max_align_t) char m_Data[SIZE];
+        size_t  m_Head;
+        size_t  m_Tail;
+        size_t  m_WrapPos;
+        bool    m_Wrapped;
+
+        static inline size_t BlockSpan(size_t size) {
+            return (HEADER_SIZE + size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+        }
+
+        inline Block* BlockAt(size_t offset) {
+            return reinterpret_cast<Block*>(m_Data + offset);
+        }
+
+    public:
+        I2CReceiveArena();
+
+        void* Alloc(size_t size);
+
+        void Release(void* buffer);
+
+        bool Owns(const void* buffer);
+
+        inline size_t GetSize(const void* buffer) {
+            return BlockAt(static_cast<const char*>(buffer) - m_Data - HEADER_SIZE)->Size;
+        }
     };
 
     class I2CReadPromiseQueue {
     private:
         struct Entry {
-            Promise* m_Promise;
+            ContinuationBase* m_Continuation;
             size_t m_RemainingSize;
             char* m_ReadBuffer;
             char* m_ReadBufferPos;
             ReadLocation m_ReadLoc;
+            uint16_t m_LastProgress; //millis() when it last got bytes
 
             Entry* m_Next;
+
+            static inline void* operator new(size_t size) noexcept {
+                return s_EntryPool.Alloc(size);
+            }
+
+            static inline void operator delete(void* ptr) {
+                s_EntryPool.Free(ptr);
+            }
         };
 
+    public:
+        typedef BlockPool<sizeof(Entry), ASYNCI2C_ENTRY_POOL_SIZE, false> EntryPool;
+
+    private:
+        static EntryPool s_EntryPool;
+
         Entry* m_Head;
+        Entry* m_Dropped; //by DropAll, for the main loop to cancel
+        I2CReceiveArena* m_Arena;
+        uint16_t m_ArenaDrops;
+
+        size_t ReleaseReadBuffer(Entry* e);
     
     public:
-        I2CReadPromiseQueue();
+        I2CReadPromiseQueue(I2CReceiveArena* arena);
 
         bool IsEmpty();
 
-        void Insert(Promise* promise, size_t readSize, ReadLocation readType, void* readPointer = nullptr);
+        //Unlinks every entry, or only if the one being read has been idle for timeout ms, for Cancel
+        Entry* Detach(uint16_t now = 0, uint16_t timeout = 0);
+
+        //Frees the buffers of detached entries and cancels their continuations, returns the bytes freed
+        size_t Cancel(Entry* e, uint8_t* count);
 
-        size_t ReadInto(size_t limit);
+        //Unlinks every entry without freeing anything, safe from an interrupt
+        void DropAll();
+
+        //Detaches what DropAll left, for Cancel
+        Entry* TakeDropped();
+
+        void Insert(ContinuationBase* cont, size_t readSize, ReadLocation readType, void* readPointer = nullptr);
+
+        //reads discarded because the receive arena had no room for them, since startup
+        uint16_t GetArenaDrops();
+
+        size_t ReadInto(Transport* link, size_t limit);
     };
 
     class I2CWritePromiseQueue {
     private:
         struct Entry {
-            Promise* m_Promise;
+            ContinuationBase* m_Continuation;
             char* m_WriteBuffer;
             char* m_WriteBufferPos;
             size_t m_RemainingSize;
+            bool m_StartsPacket;
+            uint16_t m_LastProgress; //millis() when it was queued or last had bytes read out
 
             Entry* m_Next;
+
+            static inline void* operator new(size_t size) noexcept {
+                return s_EntryPool.Alloc(size);
+            }
+
+            static inline void operator delete(void* ptr) {
+                s_EntryPool.Free(ptr);
+            }
         };
 
+    public:
+        typedef BlockPool<sizeof(Entry), ASYNCI2C_ENTRY_POOL_SIZE, false> EntryPool;
+
+    private:
+        static EntryPool s_EntryPool;
+
+        //The first read of a packet is a fixed short window. It may go on into the packets queued after it,
+        //as long as their whole prolog fits, so that the master always knows how long they are.
+        //Reads after that get the rest of the packet, as much as the master reads at once.
+        static constexpr size_t WRITE_HEAD_WINDOW = 8;
+        static constexpr size_t PACKET_PROLOG_SIZE = 3;
+
+        //entries for writes without a promise, so that constant replies need no heap
+        static constexpr size_t STATIC_ENTRY_LIMIT = 2;
+
         Entry* m_Head;
+        Entry* m_Tail;
+        Entry* m_Dropped;
+
+        Entry m_StaticEntries[STATIC_ENTRY_LIMIT];
+        uint8_t m_StaticEntriesUsed;
+
+        void ReleaseEntry(Entry* e);
+
+        void InitEntry(Entry* entry, ContinuationBase* cont, const void* data, size_t size, bool startsPacket);
+
+        //one of the static entries if any is free, else one from the pool, nullptr if that is out too
+        Entry* ClaimStaticEntry();
+
+        //links an initialized chain of entries in at the tail at once
+        void Append(Entry* first, Entry* last);
     
     public:
         I2CWritePromiseQueue();
 
-        void Insert(Promise* promise, void* data, size_t size);
+        void Insert(ContinuationBase* cont, void* data, size_t size, bool startsPacket);
 
-        size_t WriteOut();
+        void InsertStatic(const void* data, size_t size, bool startsPacket);
+
+        //A packet prolog without a promise and the contents after it, queued in one step
+        void InsertPacket(ContinuationBase* cont, const void* prolog, size_t prologSize, void* data, size_t size);
+
+        bool IsEmpty();
+
+        size_t WriteOut(Transport* link);
+
+        //As I2CReadPromiseQueue. The writes behind a stalled one are as stale, so they all go.
+        Entry* Detach(uint16_t now = 0, uint16_t timeout = 0);
+
+        //Cancels the continuations of detached entries, which free their data, returns its size
+        size_t Cancel(Entry* e, uint8_t* count);
+
+        //As I2CReadPromiseQueue
+        void DropAll();
+
+        Entry* TakeDropped();
     };
 
     struct PacketHeader {
@@ -69,6 +227,8 @@ namespace comm {
 
     class AsyncI2C {
     private:
+        Transport* m_Link;
+        I2CReceiveArena m_Arena;
         I2CReadPromiseQueue m_ReadQueue;
         I2CWritePromiseQueue m_WriteQueue;
 
@@ -76,22 +236,81 @@ namespace comm {
             AsyncI2C* Reader;
             void* Context;
         };
+
+        uint32_t m_ReclaimedBytes;
+        uint16_t m_CancelledTransfers;
+
+        void CountCancelled(size_t bytes, uint8_t count);
     public:
         AsyncI2C();
 
+        //where HandleReceive and HandleRequest move the bytes, I2C unless set otherwise
+        inline void SetTransport(Transport* link) {
+            m_Link = link;
+        }
+
+        inline Transport* GetTransport() {
+            return m_Link;
+        }
+
         bool IsReceiving();
 
+        bool IsSending();
+
         size_t HandleReceive(size_t size);
 
         void HandleRequest();
         
+        //Each transfer resumes cont once done. The continuation is the caller's and must stay alive until then.
+        void Read(ContinuationBase* cont, size_t size, ReadLocation bufferLocation = ReadLocation::HEAP);
+
+        void ReadTemp(ContinuationBase* cont, size_t size);
+
+        void ReadInto(ContinuationBase* cont, size_t size, void* dest);
+
+        void Write(ContinuationBase* cont, void* data, size_t size, bool startsPacket = false);
+
+        //The same with a new Promise for the context, to be chained with Then
         Promise* Read(void* context, size_t size, ReadLocation bufferLocation = ReadLocation::HEAP);
 
         Promise* ReadTemp(void* context, size_t size);
 
         Promise* ReadInto(void* context, size_t size, void* dest);
 
-        Promise* Write(void* context, void* data, size_t size);
+        Promise* Write(void* context, void* data, size_t size, bool startsPacket = false);
+
+        //Writes data that outlives the transfer, without a promise or any allocation
+        void WriteStatic(const void* data, size_t size, bool startsPacket = false);
+
+        //Writes a packet prolog and its contents in one step, so that the master never gets one without the other.
+        //cont is resumed once the contents are out, the prolog must live until then.
+        void WritePacket(ContinuationBase* cont, const void* prolog, size_t prologSize, void* data, size_t size);
+
+        void ReleaseBuffer(void* buffer);
+
+        //Size of a buffer read into the receive arena, 0 for any other buffer
+        size_t GetBufferSize(const void* buffer);
+
+        //Cancels the transfers dropped by Reset and those the master has left hanging for ASYNCI2C_TRANSFER_TIMEOUT.
+        //Call from the main loop. Returns whether any were.
+        bool ExpireTransfers();
+
+        //Drops every transfer in flight, for when the master starts over. Safe from an interrupt handler:
+        //the transfers are only unlinked, ExpireTransfers cancels them and frees what they held.
+        void Reset();
+
+        //buffers and data given back by cancelled transfers since startup
+        inline uint32_t GetReclaimedBytes() {
+            return m_ReclaimedBytes;
+        }
+
+        inline uint16_t GetCancelledTransfers() {
+            return m_CancelledTransfers;
+        }
+
+        inline uint16_t GetArenaDrops() {
+            return m_ReadQueue.GetArenaDrops();
+        }
     };
 }
 
@@ -0,0 +1,100 @@
+#ifndef __BLOCKPOOL_H
+#define __BLOCKPOOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "CriticalSection.h"
+
+/*
+Fixed number of equally sized blocks for objects that are created and destroyed all the time, routed through
+their class operator new and delete. Freed blocks go on a free list, blocks never used yet are taken in order.
+When the pool is out of blocks, or an object is larger than a block, it falls back on malloc, or without heapFallback
+returns nullptr (the operator new must then be noexcept). Either way it is counted as an overflow,
+so the high-water mark and the overflow count tell whether the pool is sized right.
+
+Safe to use from an interrupt. A pool must have static storage duration: it has no constructor and starts out zeroed,
+so that it works even for objects created by other static constructors.
+*/
+template<size_t blockSize, size_t count, bool heapFallback = true>
+class BlockPool {
+private:
+    static_assert(count <= 0xFF, "Block pool counters are 8 bits");
+
+    union Block {
+        Block* Next;
+        alignas(max_align_t) char Data[blockSize];
+    };
+
+    Block    m_Blocks[count];
+    Block*   m_Free;
+    uint8_t  m_Untouched; //m_Blocks from this index on have never been handed out
+    uint8_t  m_InUse;
+    uint8_t  m_HighWater;
+    uint16_t m_Overflows;
+
+public:
+    static constexpr size_t BLOCK_SIZE = blockSize;
+    static constexpr size_t BLOCK_COUNT = count;
+
+    void* Alloc(size_t size) {
+        if (size <= blockSize) {
+            CriticalSection cs;
+            Block* b = m_Free;
+            if (b) {
+                m_Free = b->Next;
+            }
+            else if (m_Untouched < count) {
+                b = &m_Blocks[m_Untouched++];
+            }
+            if (b) {
+                if (++m_InUse > m_HighWater) {
+                    m_HighWater = m_InUse;
+                }
+                return b->Data;
+            }
+        }
+        {
+            CriticalSection cs;
+            if (m_Overflows != 0xFFFF) {
+                m_Overflows++;
+            }
+        }
+        return heapFallback ? malloc(size) : nullptr;
+    }
+
+    void Free(void* ptr) {
+        if (ptr >= static_cast<void*>(m_Blocks) && ptr < static_cast<void*>(m_Blocks + count)) {
+            CriticalSection cs;
+            Block* b = static_cast<Block*>(ptr);
+            b->Next = m_Free;
+            m_Free = b;
+            m_InUse--;
+        }
+        else {
+            free(ptr);
+        }
+    }
+
+    inline uint8_t GetInUse() const {
+        return m_InUse;
+    }
+
+    //most blocks in use at once since the last reset
+    inline uint8_t GetHighWater() const {
+        return m_HighWater;
+    }
+
+    //allocations that found no block since the last reset
+    inline uint16_t GetOverflowCount() const {
+        return m_Overflows;
+    }
+
+    void ResetStats() {
+        CriticalSection cs;
+        m_HighWater = m_InUse;
+        m_Overflows = 0;
+    }
+};
+
+#endif
@@ -4,7 +4,7 @@
 
 #include "Arduino.h"
 #include <stdint.h>
-#include "Wire.h"
+#include "CriticalSection.h"
 #include <new>
 #include "BombClient.h"
 #include "Promise.h"
@@ -13,14 +13,30 @@
 #include "UARTPrint.h"
 #include "DebugPrint.h"
 
+const char BombClient::EMPTY_PACKET[] = {NetPacketProlog::START_MAGIC, 0, 0};
+const char BombClient::EMPTY_POLL_PACKET[] = {NetPacketProlog::START_MAGIC, 1, 0, 0}; //no requests
+
 BombClient::BombClient() :
     m_I2C(),
+    m_PrologRead(this, OnPrologRead),
+    m_ContentsRead(this, OnContentsRead),
     m_RequestQueueAlloc{0},
+    m_RequestQueueSent{0},
+    m_RequestPolicyCount{0},
     m_DiscoveryRequested{false},
+    m_StatusRequested{false},
     m_CurrentCommand{nullptr},
+    m_WrittenContexts{nullptr},
     m_EventDispHead{nullptr},
     m_EventDispTail{nullptr},
+    m_AcceptedEvents{0xFFFFFFFFul},
+    m_CoalescedEvents{0},
+    m_LinkErrors{0},
+    m_OpcodeCount{0},
     m_HandshakeHandler{nullptr}
+#if BOMBCLIENT_STATS
+    , m_HandlerStatsCount{0}
+#endif
 {
     memset(m_CommandHandlers, 0, sizeof(m_CommandHandlers));
     m_CommandHandlers[NetCommand::INVALID] = nullptr;
@@ -36,86 +52,93 @@ BombClient::BombClient() :
     m_CommandHandlers[NetCommand::RESPONSE] = function(BombClient* client) {
         client->HandleResponse();
     };
+    m_CommandHandlers[NetCommand::EVENT_BATCH] = function(BombClient* client) {
+        client->DispatchEventBatch();
+    };
+    m_CommandHandlers[NetCommand::STATS] = function(BombClient* client) {
+        client->RespondWithStats();
+    };
 }
 
-Promise* BombClient::ReadPacket() {
-    return m_I2C.ReadTemp(this, sizeof(NetPacketProlog))->Then<BombClient, NetPacketProlog>(function(BombClient* cl, NetPacketProlog* response) -> Promise* {
-        if (response->StartMagic == NetPacketProlog::START_MAGIC) {
-            DEBUG_PRINTF_P("Read packet of size %d.\n", response->ContentSize);
-            if (response->ContentSize) {
-                return cl->m_I2C.Read(cl, response->ContentSize);
-            }
-            else {
-                return new EmptyPromise(cl);
-            }
-        }
-        return nullptr;
-    });
+void BombClient::ReadPacket() {
+    //the prolog is read straight into the client, the contents into the receive arena
+    m_I2C.ReadInto(&m_PrologRead, sizeof(NetPacketProlog), &m_ReceivedProlog);
 }
 
-Promise* BombClient::WritePacket(void* data, size_t size, bool freeData) {
-    WriteContext* ctx = new WriteContext {this, {NetPacketProlog::START_MAGIC, size}, data, freeData};
-    return m_I2C.Write(ctx, &ctx->Prolog, sizeof(NetPacketProlog))->Then<WriteContext>(function(WriteContext* ctx) -> Promise* {
-        Promise* p;
-        if (ctx->Prolog.ContentSize) {
-            p = ctx->Cl->m_I2C.Write(ctx, ctx->Data, ctx->Prolog.ContentSize);
-        } else {
-            p = new EmptyPromise(ctx);
+void BombClient::OnPrologRead(BombClient* cl, NetPacketProlog* prolog) {
+    if (prolog->StartMagic == NetPacketProlog::START_MAGIC) {
+        DEBUG_PRINTF_P("Read packet of size %d.\n", prolog->ContentSize);
+        if (prolog->ContentSize) {
+            cl->m_I2C.Read(&cl->m_ContentsRead, prolog->ContentSize, comm::ReadLocation::ARENA);
         }
-        p->Then<WriteContext>(function(WriteContext* ctx) {
-            if (ctx->FreeData) {
-                free(ctx->Data);
-            }
-            delete ctx;
-        });
-        return p;
-    });
+    }
+    else {
+        cl->CountLinkError();
+    }
 }
 
-void BombClient::Attach(int address) {
-    Wire.setClock(28800);
-    
-    static BombClient* _wireclient = this;
+void BombClient::OnContentsRead(BombClient* cl, NetCommandPacket* command) {
+    if (!command) {
+        return; //dropped by the receive arena
+    }
+    DEBUG_PRINTF_P("Packet type %d\n", command->CommandID);
 
-    Wire.onRequest(function() {
-        DEBUG_PRINTLN("Bytes requested!")
-        BombClient* b = _wireclient;
-        if (b->m_DiscoveryRequested) {
-            b->m_DiscoveryRequested = false;
-            Wire.write(0xAE);
-            return;
-        }
-        b->m_I2C.HandleRequest();
-        DEBUG_PRINTLN("OnRequest finished.")
-    });
+    cl->EnqueueCommand(command);
+}
 
-    Wire.onReceive(function(int n) {
-        size_t bytes = (size_t) Wire.available();
+BombClient::WriteContext::WriteContext(BombClient* client, uint16_t size, void* data, bool freeData) :
+    Prolog{NetPacketProlog::START_MAGIC, size}, Data{data}, FreeData{freeData}, Written(this, OnWritten, OnCancelled),
+    Client{client}, Next{nullptr} {
 
-        if (!bytes) {
-            return;
-        }
+}
 
-        DEBUG_PRINTF_P("Receiving %d bytes...\n", n)
+void BombClient::WriteContext::OnWritten(WriteContext* ctx, void* end) {
+    //usually in the interrupt, the heap is left to FreeWrittenContexts
+    CriticalSection cs;
+    ctx->Next = ctx->Client->m_WrittenContexts;
+    ctx->Client->m_WrittenContexts = ctx;
+}
+
+void BombClient::WriteContext::OnCancelled(WriteContext* ctx) {
+    OnWritten(ctx, nullptr);
+}
 
-        BombClient* b = _wireclient;
+void BombClient::WritePacket(void* data, size_t size, bool freeData) {
+    WriteContext* ctx = new WriteContext(this, size, data, freeData);
+    if (size) {
+        m_I2C.WritePacket(&ctx->Written, &ctx->Prolog, sizeof(NetPacketProlog), data, size);
+    }
+    else {
+        m_I2C.Write(&ctx->Written, &ctx->Prolog, sizeof(NetPacketProlog), true);
+    }
+}
+
+void BombClient::Attach(int address) {
+    //the master picks the clock from what we advertise in the handshake
+    comm::Transport* link = m_I2C.GetTransport();
+    link->SetHandlers(function(size_t bytes, void* param) {
+        DEBUG_PRINTF_P("Receiving %d bytes...\n", bytes)
+
+        BombClient* b = static_cast<BombClient*>(param);
+        comm::Transport* link = b->m_I2C.GetTransport();
         bytes -= b->m_I2C.HandleReceive(bytes);
 
         if (bytes) {
-            if (Wire.peek() == 0xEA) {
+            if (link->Peek() == 0xEA) {
+                //the master is starting over, whatever we still had for it is stale - unlinked here, freed by ProcessCommands
+                b->m_I2C.Reset();
                 b->m_DiscoveryRequested = true;
-                Wire.read();
+                b->m_StatusRequested = false;
+                link->Read();
+                return;
+            }
+            else if (link->Peek() == STATUS_PROBE) {
+                b->m_StatusRequested = true;
+                link->Read();
                 return;
             }
             else {
-                b->ReadPacket()->Then<BombClient, void>(function(BombClient* cl, void* packetContents) {
-                    NetCommandPacket* command = static_cast<NetCommandPacket*>(packetContents);
-                    DEBUG_PRINTF_P("Packet type %d\n", command->CommandID);
-
-                    if (!cl->m_CommandQueue.Push(command)) {
-                        PRINTLN_P("Network command queue full!!");
-                    }
-                });
+                b->ReadPacket();
                 while (bytes) {
                     if (!b->m_I2C.IsReceiving()) {
                         break;
@@ -125,36 +148,257 @@ void BombClient::Attach(int address) {
             }
         }
         DEBUG_PRINTLN("OnReceive finished.");
-    });
+    }, function(void* param) {
+        DEBUG_PRINTLN("Bytes requested!")
+        BombClient* b = static_cast<BombClient*>(param);
+        comm::Transport* link = b->m_I2C.GetTransport();
+        if (b->m_DiscoveryRequested) {
+            b->m_DiscoveryRequested = false;
+            link->Write(0xAE);
+            return;
+        }
+        if (b->m_StatusRequested) {
+            //the master reads a single byte, the write queue stays as it is
+            b->m_StatusRequested = false;
+            link->Write(b->GetStatus() | (b->m_I2C.IsSending() ? STATUS_SENDING : 0));
+            return;
+        }
+        if (!b->m_I2C.IsSending()) {
+            link->Write(b->GetStatus());
+            return;
+        }
+        b->m_I2C.HandleRequest();
+        DEBUG_PRINTLN("OnRequest finished.")
+    }, this);
+    link->Begin(address);
+}
 
-    Wire.begin(address);
+void BombClient::EnqueueCommand(NetCommandPacket* command) {
+    //the receive handler is the only producer, stale state updates are left for ProcessCommands to skip
+    size_t limit = IsCoalesced(command) ? COMMAND_QUEUE_LIMIT - COMMAND_QUEUE_RESERVED : COMMAND_QUEUE_LIMIT;
+    if (m_CommandQueue.Count() >= limit || !m_CommandQueue.Push({command, LatencyStats::Now()})) {
+        PRINTLN_P("Network command queue full!!");
+        m_I2C.ReleaseBuffer(command);
+    }
+}
+
+bool BombClient::IsCoalesced(NetCommandPacket* command) {
+    //an acked command has the server waiting for its own response
+    if (command->GetCommand() != NetCommand::EVENT || command->IsAckRequested()) {
+        return false;
+    }
+    //an empty event has no ID to coalesce on, DispatchEvent drops it
+    if (!GetParamsSize(command)) {
+        return false;
+    }
+    uint8_t eventId = command->Params[0];
+    return eventId < 32 && (m_CoalescedEvents & (1ul << eventId));
+}
+
+bool BombClient::IsSuperseded(NetCommandPacket* command) {
+    if (!IsCoalesced(command)) {
+        return false;
+    }
+    //queued slots are not touched by the producer until we pop them
+    for (size_t i = 0; i < m_CommandQueue.Count(); i++) {
+        NetCommandPacket* queued = m_CommandQueue.Peek(i).Packet;
+        if (IsCoalesced(queued) && queued->Params[0] == command->Params[0]) {
+            return true;
+        }
+    }
+    return false;
 }
 
 void BombClient::ProcessCommands() {
+    m_I2C.GetTransport()->Poll();
+    m_I2C.ExpireTransfers();
+    FreeWrittenContexts();
     while (m_CommandQueue.HasNext()) {
-        m_CurrentCommand = m_CommandQueue.Pop();
+        QueuedCommand queued = m_CommandQueue.Pop();
+        m_CurrentCommand = queued.Packet;
+        if (IsSuperseded(m_CurrentCommand)) {
+            ClosePacket(m_CurrentCommand);
+            continue;
+        }
 
-        if (m_CurrentCommand->CommandID < NetCommand::NET_COMMAND_MAX && m_CommandHandlers[m_CurrentCommand->CommandID]) {
-            cli();
-            m_CommandHandlers[m_CurrentCommand->CommandID](this);
-            sei();
+        NetCommand cmd = m_CurrentCommand->GetCommand();
+        if (cmd < NetCommand::NET_COMMAND_MAX && m_CommandHandlers[cmd]) {
+            m_CommandHandlers[cmd](this);
+#if BOMBCLIENT_STATS
+            m_CommandStats[cmd].Add(LatencyStats::Since(queued.ReceivedAt));
+#endif
         }
-        m_CurrentCommand->Close();
+        else {
+            CountLinkError();
+        }
+        ClosePacket(m_CurrentCommand);
     }
+    //only now, a response that came in with this batch is not late
+    ExpireRequests();
 }
 
-void BombClient::DispatchEvent() {
+void BombClient::ClosePacket(NetCommandPacket* packet) {
+    CriticalSection cs;
+    m_I2C.ReleaseBuffer(packet);
+}
+
+void BombClient::FreeWrittenContexts() {
+    WriteContext* ctx;
+    {
+        CriticalSection cs;
+        ctx = m_WrittenContexts;
+        m_WrittenContexts = nullptr;
+    }
+    while (ctx) {
+        WriteContext* next = ctx->Next;
+        if (ctx->FreeData) {
+            free(ctx->Data);
+        }
+        delete ctx;
+        ctx = next;
+    }
+}
+
+void BombClient::CountLinkError() {
+    CriticalSection cs;
+    if (m_LinkErrors != 0xFF) {
+        m_LinkErrors++;
+    }
+}
+
+uint8_t BombClient::GetStatus() {
+    uint8_t requests = CountBits(m_RequestQueueAlloc & ~m_RequestQueueSent);
+    if (requests > STATUS_REQUESTS_MASK) {
+        requests = STATUS_REQUESTS_MASK;
+    }
+    size_t commands = m_CommandQueue.Count();
+    if (commands > STATUS_COMMANDS_MAX) {
+        commands = STATUS_COMMANDS_MAX;
+    }
+    return requests | (commands << STATUS_COMMANDS_SHIFT);
+}
+
+void BombClient::DispatchEventRecord(uint8_t eventId, void* eventData) {
     EventDispatcherHandle* evd = m_EventDispHead;
-    uint8_t eventId = m_CurrentCommand->Params[0];
-    void* eventData = &m_CurrentCommand->Params[1];
     while (evd) {
         evd->m_Func(eventId, eventData, evd->m_Param);
         evd = evd->m_Next;
     }
-    EmptyResponse();
+}
+
+bool BombClient::IsEventAccepted(uint8_t eventId) {
+    //unicast events have already been filtered by the server
+    return !m_CurrentCommand->IsBroadcast() || (eventId < 32 && (m_AcceptedEvents & (1ul << eventId)));
+}
+
+void BombClient::DispatchEvent() {
+    if (!GetCurrentParamsSize()) {
+        PRINTLN_P("Event without an ID, dropped");
+        CountLinkError();
+    }
+    else {
+        uint8_t eventId = m_CurrentCommand->Params[0];
+        if (IsEventAccepted(eventId)) {
+            DispatchEventRecord(eventId, &m_CurrentCommand->Params[1]);
+        }
+    }
+    //the server still waits for the ack of a malformed event
+    if (m_CurrentCommand->IsAckRequested()) {
+        EmptyResponse();
+    }
+}
+
+void BombClient::DispatchEventBatch() {
+    //count, then (eventId, dataSize, data[dataSize]) for each record
+    size_t paramsSize = GetCurrentParamsSize();
+    const char* end = m_CurrentCommand->Params + paramsSize;
+    uint8_t count = paramsSize ? m_CurrentCommand->Params[0] : 0;
+    char* record = &m_CurrentCommand->Params[1];
+    for (uint8_t i = 0; i < count; i++) {
+        //a record that runs past the packet is garbage, and so is anything after it
+        if (end - record < 2 || (size_t) (end - record - 2) < (uint8_t) record[1]) {
+            PRINTF_P("Event batch truncated at record %d of %d!\n", i, count);
+            CountLinkError();
+            break;
+        }
+        uint8_t eventId = record[0];
+        uint8_t dataSize = record[1];
+        if (IsEventAccepted(eventId)) {
+            DispatchEventRecord(eventId, &record[2]);
+        }
+        record += 2 + dataSize;
+    }
+    if (m_CurrentCommand->IsAckRequested()) {
+        EmptyResponse();
+    }
+}
+
+size_t BombClient::GetParamsSize(NetCommandPacket* packet) {
+    size_t size = m_I2C.GetBufferSize(packet);
+    return size ? size - 1 : 0;
+}
+
+size_t BombClient::GetCurrentParamsSize() {
+    return GetParamsSize(m_CurrentCommand);
+}
+
+void BombClient::LoadOpcodeTable(const char* table, size_t size) {
+    //count, then the hash of each handler
+    m_OpcodeCount = 0;
+    if (size < 1) {
+        return;
+    }
+    uint8_t count = table[0];
+    if (count > (size - 1) / sizeof(IDHASH)) {
+        count = (size - 1) / sizeof(IDHASH);
+    }
+    if (count > OPCODE_TABLE_LIMIT) {
+        count = OPCODE_TABLE_LIMIT;
+    }
+    memcpy(m_OpcodeTable, table + 1, count * sizeof(IDHASH));
+    m_OpcodeCount = count;
+}
+
+uint8_t BombClient::GetOpcode(IDHASH handlerId) {
+    for (uint8_t i = 0; i < m_OpcodeCount; i++) {
+        if (m_OpcodeTable[i] == handlerId) {
+            return i;
+        }
+    }
+    return OPCODE_ESCAPE;
+}
+
+size_t BombClient::GetVarintSize(uint16_t value) {
+    size_t size = 1;
+    while (value >= 0x80) {
+        value >>= 7;
+        size++;
+    }
+    return size;
+}
+
+char* BombClient::WriteVarint(char* out, uint16_t value) {
+    //LEB128 - 7 bits at a time, high bit set if more follow
+    while (value >= 0x80) {
+        *(out++) = (value & 0x7F) | 0x80;
+        value >>= 7;
+    }
+    *(out++) = value;
+    return out;
 }
 
 void BombClient::RespondToHandshake() {
+    //greeting, then the opcode table
+    const char* params = m_CurrentCommand->Params;
+    size_t paramsSize = GetCurrentParamsSize();
+    size_t greetingSize = strnlen(params, paramsSize);
+    if (greetingSize < paramsSize) {
+        LoadOpcodeTable(params + greetingSize + 1, paramsSize - greetingSize - 1);
+    }
+    else {
+        m_OpcodeCount = 0;
+    }
+
     void* data = nullptr;
     size_t dataSize = 0;
     if (m_HandshakeHandler) {
@@ -164,92 +408,310 @@ void BombClient::RespondToHandshake() {
     void* packet = malloc(packetSize);
     HandshakeResponse* r = reinterpret_cast<HandshakeResponse*>(packet);
     memcpy(r->CheckCode, HandshakeResponse::CHECK_CODE, sizeof(r->CheckCode));
+    r->Link.MaxClock = BOMBCLIENT_MAX_I2C_CLOCK;
+    r->Link.ErrorCount = m_LinkErrors;
     memcpy(&r->ModuleInfo, data, dataSize);
     free(data);
     WritePacket(r, packetSize, true);
 }
 
+void BombClient::RespondWithStats() {
+    //an empty set of statistics when they are left out, so that the server is not kept waiting
+#if BOMBCLIENT_STATS
+    size_t handlerRecordSize = sizeof(IDHASH) + 2 * sizeof(LatencyStats::Record);
+    size_t commandCount = NET_COMMAND_MAX - NetCommand::POLL;
+    size_t packetSize = sizeof(StatsResponseHeader) + m_HandlerStatsCount * handlerRecordSize + commandCount * sizeof(LatencyStats::Record);
+#else
+    size_t packetSize = sizeof(StatsResponseHeader);
+#endif
+    char* packet = static_cast<char*>(malloc(packetSize));
+    StatsResponseHeader* header = reinterpret_cast<StatsResponseHeader*>(packet);
+    header->BucketCount = LatencyStats::BUCKET_COUNT;
+    header->HandlerCount = 0;
+    header->CommandCount = 0;
+#if BOMBCLIENT_STATS
+    header->HandlerCount = m_HandlerStatsCount;
+    header->CommandCount = commandCount;
+    char* out = packet + sizeof(StatsResponseHeader);
+    for (size_t i = 0; i < m_HandlerStatsCount; i++) {
+        memcpy(out, &m_HandlerStats[i].HandlerID, sizeof(IDHASH));
+        out += sizeof(IDHASH);
+        m_HandlerStats[i].Wait.Write(reinterpret_cast<LatencyStats::Record*>(out));
+        out += sizeof(LatencyStats::Record);
+        m_HandlerStats[i].Response.Write(reinterpret_cast<LatencyStats::Record*>(out));
+        out += sizeof(LatencyStats::Record);
+    }
+    for (size_t cmd = NetCommand::POLL; cmd < NET_COMMAND_MAX; cmd++) {
+        m_CommandStats[cmd].Write(reinterpret_cast<LatencyStats::Record*>(out));
+        out += sizeof(LatencyStats::Record);
+    }
+
+    uint8_t flags = GetCurrentParamsSize() ? m_CurrentCommand->Params[0] : 0;
+    if (flags & STATS_FLAG_RESET) {
+        //the handlers stay in their slots, they are likely to be queued again
+        for (size_t i = 0; i < m_HandlerStatsCount; i++) {
+            m_HandlerStats[i].Wait.Reset();
+            m_HandlerStats[i].Response.Reset();
+        }
+        for (size_t cmd = 0; cmd < NET_COMMAND_MAX; cmd++) {
+            m_CommandStats[cmd].Reset();
+        }
+    }
+#endif
+    WritePacket(packet, packetSize, true);
+}
+
+BombClient::HandlerStats* BombClient::GetHandlerStats(IDHASH handlerId) {
+#if BOMBCLIENT_STATS
+    for (size_t i = 0; i < m_HandlerStatsCount; i++) {
+        if (m_HandlerStats[i].HandlerID == handlerId) {
+            return &m_HandlerStats[i];
+        }
+    }
+    if (m_HandlerStatsCount < STATS_HANDLER_LIMIT) {
+        HandlerStats* stats = &m_HandlerStats[m_HandlerStatsCount++];
+        stats->HandlerID = handlerId;
+        return stats;
+    }
+#endif
+    return nullptr;
+}
+
 void BombClient::HandleResponse() {
+    if (!GetCurrentParamsSize()) {
+        PRINTLN_P("Response without an ID, dropped");
+        CountLinkError();
+        return;
+    }
     uint8_t respId = m_CurrentCommand->Params[0];
     void* respData = &m_CurrentCommand->Params[1];
-    if (respId < REQUEST_POOL_LIMIT) {
+    if (respId >= REQUEST_POOL_LIMIT) {
+        PRINTF_P("Response ID out of range: %d\n", respId);
+    }
+    else if (!(m_RequestQueueSent & BitMask(respId))) {
+        //expired, the slot may hold a newer request already
+        PRINTF_P("Response %d has no request waiting, dropped\n", respId);
+    }
+    else {
+        HandlerStats* stats = GetHandlerStats(m_RequestPool[respId].HandlerID);
+        if (stats) {
+            stats->Response.Add(LatencyStats::Since(m_RequestPool[respId].SentAt));
+        }
+        //the data stays in the packet until ProcessCommands closes it, the handler may work on it in place
         if (m_RequestPool[respId].ResponseHandler) {
             m_RequestPool[respId].ResponseHandler(respData, m_RequestPool[respId].ResponseHandlerParam);
         }
+        ReleaseRequestParams(respId);
+        CriticalSection cs;
+        m_RequestQueueAlloc &= ~BitMask(respId);
+        m_RequestQueueSent &= ~BitMask(respId);
     }
-    else {
-        PRINTF_P("Response ID out of range: %d\n", respId);
-    }
-    m_RequestQueueAlloc &= ~BitMask(respId);
 }
 
 void BombClient::EmptyResponse() {
-    WritePacket(nullptr, 0);
+    m_I2C.WriteStatic(EMPTY_PACKET, sizeof(EMPTY_PACKET), true);
 }
 
 void BombClient::FlushRequests() {
     size_t packetSize = 1; //count
-    uint32_t mask = m_RequestQueueAlloc;
+    //requests already sent are waiting for their response, their params are gone
+    RequestMask mask = m_RequestQueueAlloc & ~m_RequestQueueSent;
+    if (!mask) {
+        m_I2C.WriteStatic(EMPTY_POLL_PACKET, sizeof(EMPTY_POLL_PACKET), true);
+        return;
+    }
     size_t entryCount = 0;
     for (size_t i = 0; i < REQUEST_POOL_LIMIT; i++) {
         if (mask & BitMask(i)) {
+            ServerRequest* r = &m_RequestPool[i];
             entryCount++;
-            packetSize += 7 + m_RequestPool[i].ParamsSize;
+            r->Opcode = GetOpcode(r->HandlerID);
+            packetSize += 2 + (r->Opcode == OPCODE_ESCAPE ? sizeof(r->HandlerID) : 0) + GetVarintSize(r->ParamsSize) + r->ParamsSize;
         }
     }
-    char* pbuf = new char[packetSize];
+    char* pbuf = static_cast<char*>(malloc(packetSize)); //freed with the WriteContext
     pbuf[0] = entryCount;
     char* pstream = pbuf + 1;
     
+    //the server runs them in this order
     for (size_t i = 0; i < REQUEST_POOL_LIMIT; i++) {
-        if (mask & BitMask(i)) {
-            ServerRequest* r = &m_RequestPool[i];
-            *(pstream++) = i;
-            memcpy(pstream, &r->HandlerID, sizeof(r->HandlerID));
-            pstream += sizeof(r->HandlerID);
-            memcpy(pstream, &r->ParamsSize, sizeof(r->ParamsSize));
-            pstream += sizeof(r->ParamsSize);
-            memcpy(pstream, r->Params, r->ParamsSize);
-            pstream += r->ParamsSize;
-            delete r->Params;
+        if ((mask & BitMask(i)) && (m_RequestPool[i].Policy & REQUEST_CRITICAL)) {
+            pstream = WriteRequest(pstream, i);
+        }
+    }
+    for (size_t i = 0; i < REQUEST_POOL_LIMIT; i++) {
+        if ((mask & BitMask(i)) && !(m_RequestPool[i].Policy & REQUEST_CRITICAL)) {
+            pstream = WriteRequest(pstream, i);
         }
     }
     
+    {
+        CriticalSection cs;
+        m_RequestQueueSent |= mask;
+    }
     WritePacket(pbuf, packetSize, true);
 }
 
-size_t BombClient::GetAvailableRequestId() {
-    size_t allocIndex = REQUEST_POOL_FULL;
+char* BombClient::WriteRequest(char* out, size_t id) {
+    ServerRequest* r = &m_RequestPool[id];
+    r->SentAt = LatencyStats::Now();
+    HandlerStats* stats = GetHandlerStats(r->HandlerID);
+    if (stats) {
+        stats->Wait.Add((uint16_t) (r->SentAt - r->QueuedAt));
+    }
+    *(out++) = id;
+    *(out++) = r->Opcode;
+    if (r->Opcode == OPCODE_ESCAPE) {
+        memcpy(out, &r->HandlerID, sizeof(r->HandlerID));
+        out += sizeof(r->HandlerID);
+    }
+    out = WriteVarint(out, r->ParamsSize);
+    memcpy(out, r->Params, r->ParamsSize);
+    out += r->ParamsSize;
+    if (!(r->Policy & REQUEST_RETRY)) {
+        ReleaseRequestParams(id);
+    }
+    return out;
+}
+
+uint8_t BombClient::CountBits(RequestMask mask) {
+    return sizeof(RequestMask) <= sizeof(unsigned int) ? __builtin_popcount(mask) : __builtin_popcountl(mask);
+}
+
+size_t BombClient::GetAvailableRequestId(bool critical) {
+    if (!critical && CountBits(m_RequestQueueAlloc) >= REQUEST_POOL_LIMIT - REQUEST_POOL_RESERVED) {
+        return REQUEST_POOL_FULL;
+    }
+    //first zero bit
+    RequestMask free = ~m_RequestQueueAlloc;
+    if (!free) {
+        return REQUEST_POOL_FULL;
+    }
+    size_t allocIndex = sizeof(RequestMask) <= sizeof(unsigned int) ? __builtin_ctz(free) : __builtin_ctzl(free);
+    return allocIndex < REQUEST_POOL_LIMIT ? allocIndex : REQUEST_POOL_FULL;
+}
+
+void BombClient::QueueRequest(IDHASH handlerId)  {
+    InsertRequest(handlerId, nullptr, 0, nullptr, nullptr);
+}
+
+void BombClient::ReleaseRequestParams(size_t id) {
+    delete[] m_RequestPool[id].Params;
+    m_RequestPool[id].Params = nullptr;
+}
+
+void BombClient::DiscardRequests() {
+    RequestMask discarded;
+    {
+        CriticalSection cs;
+        discarded = m_RequestQueueAlloc;
+        m_RequestQueueAlloc = 0;
+        m_RequestQueueSent = 0;
+    }
     for (size_t i = 0; i < REQUEST_POOL_LIMIT; i++) {
-        if ((m_RequestQueueAlloc & BitMask(i)) == 0) {
-            allocIndex = i;
-            break;
+        if (discarded & BitMask(i)) {
+            ReleaseRequestParams(i);
         }
     }
-    return allocIndex;
 }
 
-void BombClient::QueueRequest(const char* handlerName)  {
-    size_t allocIndex = GetAvailableRequestId();
-    if (allocIndex != REQUEST_POOL_FULL) {
-        InsertRequest(allocIndex, handlerName, nullptr, 0, nullptr, nullptr);
+void BombClient::SetRequestPolicy(IDHASH handlerId, RequestPolicy policy) {
+    for (size_t i = 0; i < m_RequestPolicyCount; i++) {
+        if (m_RequestPolicies[i].HandlerID == handlerId) {
+            m_RequestPolicies[i].Policy = policy;
+            return;
+        }
+    }
+    if (m_RequestPolicyCount < REQUEST_POLICY_LIMIT) {
+        m_RequestPolicies[m_RequestPolicyCount++] = {handlerId, policy};
     }
     else {
-        PRINTF_P("Could not insert request for %s - queue full!\n", handlerName);
+        PRINTF_P("Too many request policies, %08lX ignored!\n", (unsigned long) handlerId);
     }
 }
 
-void BombClient::DiscardRequests() {
-    m_RequestQueueAlloc = 0;
+BombClient::RequestPolicy BombClient::GetRequestPolicy(IDHASH handlerId) {
+    for (size_t i = 0; i < m_RequestPolicyCount; i++) {
+        if (m_RequestPolicies[i].HandlerID == handlerId) {
+            return m_RequestPolicies[i].Policy;
+        }
+    }
+    return REQUEST_DEFAULT;
 }
 
-void BombClient::InsertRequest(size_t id, const char* handlerName, void* params, size_t paramSize, void(*responseHandler)(void*, void*), void* handleRespParam) {
-    ServerRequest* req = &m_RequestPool[id];
-    req->HandlerID = HashID(handlerName);
+size_t BombClient::FindPendingRequest(IDHASH handlerId) {
+    //once sent, the server answers it with what it knew then
+    RequestMask unsent = m_RequestQueueAlloc & ~m_RequestQueueSent;
+    for (size_t i = 0; i < REQUEST_POOL_LIMIT; i++) {
+        if ((unsent & BitMask(i)) && m_RequestPool[i].HandlerID == handlerId) {
+            return i;
+        }
+    }
+    return REQUEST_POOL_FULL;
+}
+
+void BombClient::ExpireRequests() {
+#if BOMBCLIENT_RESPONSE_TIMEOUT
+    //the server answers in the same sync it polled us in, a request it has not is lost with the packet it came in,
+    //or its response was dropped for want of room in the receive arena. REQUEST_RETRY ones go out with the next POLL.
+    RequestMask expired = 0;
+    RequestMask retried = 0;
+    for (size_t i = 0; i < REQUEST_POOL_LIMIT; i++) {
+        ServerRequest* r = &m_RequestPool[i];
+        if ((m_RequestQueueSent & BitMask(i)) && LatencyStats::Since(r->SentAt) > BOMBCLIENT_RESPONSE_TIMEOUT) {
+            if ((r->Policy & REQUEST_RETRY) && r->Retries < BOMBCLIENT_REQUEST_RETRIES) {
+                PRINTF_P("No response for %08lX, sending again\n", (unsigned long) r->HandlerID);
+                r->Retries++;
+                retried |= BitMask(i);
+            }
+            else {
+                PRINTF_P("No response for %08lX, dropped\n", (unsigned long) r->HandlerID);
+                ReleaseRequestParams(i);
+                expired |= BitMask(i);
+            }
+        }
+    }
+    if (expired | retried) {
+        CriticalSection cs;
+        m_RequestQueueAlloc &= ~expired;
+        m_RequestQueueSent &= ~(expired | retried);
+    }
+#endif
+}
+
+void BombClient::InsertRequest(IDHASH handlerId, void* params, size_t paramSize, void(*responseHandler)(void*, void*), void* handleRespParam) {
+    RequestPolicy policy = GetRequestPolicy(handlerId);
+    size_t id = REQUEST_POOL_FULL;
+    if (policy & REQUEST_REPLACE_PENDING) {
+        id = FindPendingRequest(handlerId);
+    }
+
+    ServerRequest* req;
+    if (id != REQUEST_POOL_FULL) {
+        req = &m_RequestPool[id];
+        if (req->ParamsSize != paramSize) {
+            delete[] req->Params;
+            req->Params = new char[paramSize];
+        }
+    }
+    else {
+        id = GetAvailableRequestId(policy & REQUEST_CRITICAL);
+        if (id == REQUEST_POOL_FULL) {
+            PRINTF_P("Could not insert request for %08lX - queue full!\n", (unsigned long) handlerId);
+            return;
+        }
+        req = &m_RequestPool[id];
+        req->Params = new char[paramSize];
+        req->QueuedAt = LatencyStats::Now();
+        req->Retries = 0;
+    }
+
+    req->HandlerID = handlerId;
+    req->Policy = policy;
     req->ParamsSize = paramSize;
-    req->Params = new char[paramSize];
     req->ResponseHandler = responseHandler;
     req->ResponseHandlerParam = handleRespParam;
     memcpy(req->Params, params, paramSize);
+    CriticalSection cs;
     m_RequestQueueAlloc |= BitMask(id);
-}
\ No newline at end of file
+}
@@ -3,14 +3,66 @@
 
 #include "Arduino.h"
 #include <stdint.h>
-#include "Wire.h"
 #include <new>
 #include "Common.h"
 #include "AsyncI2CLib.h"
+#include "Continuation.h"
 #include "RingBuffer.h"
+#include "CriticalSection.h"
+#include "LatencyStats.h"
 
 #define function []
 
+//Fastest I2C clock this module can keep up with, advertised in the handshake
+#ifndef BOMBCLIENT_MAX_I2C_CLOCK
+#define BOMBCLIENT_MAX_I2C_CLOCK 400000ul
+#endif
+
+//Requests that can wait for the server at once, at most 32
+#ifndef BOMBCLIENT_REQUEST_POOL_SIZE
+#define BOMBCLIENT_REQUEST_POOL_SIZE 6
+#endif
+
+//Handlers the server can give opcodes to, the others are sent by their full IDHASH. The server has 7.
+#ifndef BOMBCLIENT_OPCODE_TABLE_SIZE
+#define BOMBCLIENT_OPCODE_TABLE_SIZE 8
+#endif
+
+//A request sent in a POLL response and not answered for this many ms is given up, 0 to wait forever
+#ifndef BOMBCLIENT_RESPONSE_TIMEOUT
+#define BOMBCLIENT_RESPONSE_TIMEOUT 2000
+#endif
+
+//Times a REQUEST_RETRY request is sent again after it timed out
+#ifndef BOMBCLIENT_REQUEST_RETRIES
+#define BOMBCLIENT_REQUEST_RETRIES 3
+#endif
+
+//Latency statistics for the STATS command, 0 to leave them out
+#ifndef BOMBCLIENT_STATS
+#define BOMBCLIENT_STATS 1
+#endif
+
+//Handlers that get their own request statistics, the first ones queued
+#ifndef BOMBCLIENT_STATS_HANDLER_LIMIT
+#define BOMBCLIENT_STATS_HANDLER_LIMIT 2
+#endif
+
+/*
+Threading: the transport handlers run in the TWI interrupt (or from Transport::Poll on links without one), everything else (command handlers, event dispatchers,
+request handlers, module code) runs in the main loop with interrupts on. State shared with the interrupt:
+- m_CommandQueue: lock-free, the receive handler pushes (with the time of arrival) and ProcessCommands pops
+- the receive arena: allocated in the interrupt, released in a CriticalSection
+- the write queue: appended to and its static entries claimed in a CriticalSection, drained by the interrupt
+- m_WrittenContexts: pushed by the interrupt (or a cancel) once a packet is done with, freed by ProcessCommands
+- m_RequestQueueAlloc/Sent: read by the interrupt for the status byte, written in a CriticalSection
+- m_LinkErrors: counted from both sides in a CriticalSection
+- m_DiscoveryRequested, m_StatusRequested: single bytes set and cleared by the interrupt
+Anything else must not be touched from an interrupt.
+Neither must the heap, as malloc is not reentrant: the interrupt takes its transfer entries and promises from pools
+(chains resolved there must fit in PROMISE_POOL_SIZE) and its buffers from the receive arena, and leaves what the main loop
+allocated for a write to be freed there.
+*/
 class BombClient {
 public:
     typedef void(*EventDispatcher)(uint8_t eventId, void* eventData, void* param);
@@ -24,6 +76,13 @@ public:
     struct TRequest {
 
     };
+
+    enum RequestPolicy : uint8_t {
+        REQUEST_DEFAULT = 0,
+        REQUEST_REPLACE_PENDING = (1 << 0), //overwrite a request to the same handler that has not been sent yet
+        REQUEST_CRITICAL = (1 << 1), //sent first, and may use the reserved pool slots
+        REQUEST_RETRY = (1 << 2), //keeps its params until answered, sent again if the response was lost
+    };
 private:
     struct EventDispatcherHandle {
         EventDispatcher m_Func;
@@ -31,33 +90,78 @@ private:
         EventDispatcherHandle* m_Next;
     };
 
-    struct NetPacketProlog {
+    struct __attribute__((packed)) NetPacketProlog {
         static constexpr char START_MAGIC = 0xFE;
 
         char        StartMagic;
         uint16_t    ContentSize;
     };
 
+    //prolog and contents of the packets we send most, so that they need no allocation
+    static const char EMPTY_PACKET[sizeof(NetPacketProlog)];
+    static const char EMPTY_POLL_PACKET[sizeof(NetPacketProlog) + 1];
+
+    //everything a packet write needs until the last byte is out, one allocation per packet
     struct WriteContext {
-        BombClient* Cl;
         NetPacketProlog Prolog;
         void* Data;
         bool FreeData;
+        Continuation<WriteContext> Written;
+        BombClient* Client;
+        WriteContext* Next; //in m_WrittenContexts
+
+        WriteContext(BombClient* client, uint16_t size, void* data, bool freeData);
+
+        static void OnWritten(WriteContext* ctx, void* end);
+
+        static void OnCancelled(WriteContext* ctx);
     };
 
     struct ServerRequest {
         IDHASH      HandlerID;
+        RequestPolicy Policy;
+        uint8_t     Opcode;
         uint16_t    ParamsSize;
         char*       Params;
         void(*      ResponseHandler)(void* resp, void* param);
         void*       ResponseHandlerParam;
+        uint16_t    QueuedAt; //LatencyStats::Now() at the first insert, a replaced request keeps waiting since then
+        uint16_t    SentAt;
+        uint8_t     Retries;
     };
 
-    struct HandshakeResponse {
+    struct HandlerStats {
+        IDHASH       HandlerID;
+        LatencyStats Wait; //queued until sent in a POLL response
+        LatencyStats Response; //sent until the response is handled
+    };
+
+    struct __attribute__((packed)) StatsResponseHeader {
+        uint8_t BucketCount;
+        uint8_t HandlerCount; //each is its IDHASH, then the Wait and Response records
+        uint8_t CommandCount; //a record for each command from POLL on, received until handled
+    };
+
+    enum StatsFlag : uint8_t {
+        STATS_FLAG_RESET = (1 << 0) //start over once read
+    };
+
+    struct RequestPolicyEntry {
+        IDHASH        HandlerID;
+        RequestPolicy Policy;
+    };
+
+    struct __attribute__((packed)) LinkInfo {
+        uint32_t MaxClock;
+        uint8_t  ErrorCount; //malformed packets received since startup
+    };
+
+    struct __attribute__((packed)) HandshakeResponse {
         static constexpr const char* CHECK_CODE = "Julka";
 
-        char    CheckCode[6];
-        char    ModuleInfo[];
+        char     CheckCode[6];
+        LinkInfo Link;
+        char     ModuleInfo[];
     };
 
     enum NetCommand : uint8_t {
@@ -66,55 +170,144 @@ private:
         RESPONSE,
         EVENT,
         HANDSHAKE,
+        EVENT_BATCH,
+        STATS,
 
         NET_COMMAND_MAX,
     };
 
+    enum NetCommandFlag : uint8_t {
+        NETCMD_FLAG_BROADCAST = (1 << 6), //sent to the general call address, filtered locally
+        NETCMD_FLAG_NO_ACK = (1 << 7), //the server does not read back an empty response
+
+        NETCMD_FLAG_MASK = NETCMD_FLAG_BROADCAST | NETCMD_FLAG_NO_ACK
+    };
+
     struct NetCommandPacket {
         NetCommand  CommandID;
         char        Params[];
 
+        inline NetCommand GetCommand() {
+            return static_cast<NetCommand>(CommandID & ~NETCMD_FLAG_MASK);
+        }
+
+        inline bool IsBroadcast() {
+            return CommandID & NETCMD_FLAG_BROADCAST;
+        }
+
+        inline bool IsAckRequested() {
+            //every module on the bus would respond to a broadcast at once
+            return !(CommandID & (NETCMD_FLAG_NO_ACK | NETCMD_FLAG_BROADCAST));
+        }
+
         template<typename T>
         inline T* GetData() {
             return reinterpret_cast<T*>(Params);
         }
+    };
 
-        inline void Close() {
-            free(this);
-        }
+    struct QueuedCommand {
+        NetCommandPacket* Packet;
+        uint16_t    ReceivedAt;
     };
 
-    static constexpr size_t REQUEST_POOL_LIMIT = 8;
+    static constexpr size_t REQUEST_POOL_LIMIT = BOMBCLIENT_REQUEST_POOL_SIZE;
+    static constexpr size_t REQUEST_POOL_RESERVED = 2; //only for critical requests
     static constexpr size_t REQUEST_POOL_FULL = -1;
+    static_assert(REQUEST_POOL_LIMIT <= 32, "Request pool too large");
+    static_assert(REQUEST_POOL_LIMIT > REQUEST_POOL_RESERVED, "Request pool too small");
 
-    static constexpr size_t COMMAND_QUEUE_LIMIT = 8;
+    //one bit per pool slot
+    typedef typename TypeSelect<(REQUEST_POOL_LIMIT <= 8), uint8_t,
+        typename TypeSelect<(REQUEST_POOL_LIMIT <= 16), uint16_t, uint32_t>::Type>::Type RequestMask;
+
+    static constexpr size_t REQUEST_POLICY_LIMIT = 8;
+
+    static constexpr size_t COMMAND_QUEUE_LIMIT = 8; //power of two
+    static constexpr size_t COMMAND_QUEUE_RESERVED = 2; //for anything that isn't a coalesced event
+
+    //Sent for a read while we have nothing to write. Bit 7 is clear so it can't be mistaken for a packet start.
+    static constexpr uint8_t STATUS_REQUESTS_MASK = 0x0F; //requests not yet sent to the server
+    static constexpr uint8_t STATUS_COMMANDS_SHIFT = 4; //received commands not yet processed
+    static constexpr uint8_t STATUS_COMMANDS_MAX = 7;
+    //The master broadcasts this before the 1-byte status reads of a sync. The next read is answered with the status
+    //byte alone, so that it does not eat into a queued packet, with bit 7 set if one is queued.
+    static constexpr uint8_t STATUS_PROBE = 0xEB;
+    static constexpr uint8_t STATUS_SENDING = 0x80;
+
+    //Handlers are sent as their index in the table the server gives us in the handshake
+    static constexpr size_t OPCODE_TABLE_LIMIT = BOMBCLIENT_OPCODE_TABLE_SIZE;
+    static constexpr uint8_t OPCODE_ESCAPE = 0xFF; //not in the table, the full IDHASH follows
+    static_assert(OPCODE_TABLE_LIMIT < OPCODE_ESCAPE, "Opcode table too large");
 
     comm::AsyncI2C   m_I2C;
 
+    //one packet is read at a time: the prolog, then the contents into the receive arena
+    NetPacketProlog  m_ReceivedProlog;
+    Continuation<BombClient, NetPacketProlog> m_PrologRead;
+    Continuation<BombClient, NetCommandPacket> m_ContentsRead;
+
     ServerRequest    m_RequestPool[REQUEST_POOL_LIMIT];
-    uint32_t         m_RequestQueueAlloc;
+    RequestMask      m_RequestQueueAlloc;
+    RequestMask      m_RequestQueueSent;
+
+    RequestPolicyEntry m_RequestPolicies[REQUEST_POLICY_LIMIT];
+    uint8_t          m_RequestPolicyCount;
 
     bool             m_DiscoveryRequested;
+    bool             m_StatusRequested;
 
-    RingBuffer<NetCommandPacket*, COMMAND_QUEUE_LIMIT> m_CommandQueue;
+    RingBuffer<QueuedCommand, COMMAND_QUEUE_LIMIT> m_CommandQueue;
     NetCommandPacket* m_CurrentCommand;
 
+    WriteContext*    m_WrittenContexts;
+
     void(*m_CommandHandlers[NET_COMMAND_MAX])(BombClient* client);
 
     EventDispatcherHandle* m_EventDispHead;
     EventDispatcherHandle* m_EventDispTail;
 
+    uint32_t         m_AcceptedEvents;
+    uint32_t         m_CoalescedEvents;
+
+    uint8_t          m_LinkErrors;
+
+    IDHASH           m_OpcodeTable[OPCODE_TABLE_LIMIT];
+    uint8_t          m_OpcodeCount;
+
     HandshakeHandler m_HandshakeHandler;
     void*            m_HandshakeHandlerParam;
 
+#if BOMBCLIENT_STATS
+    static constexpr size_t STATS_HANDLER_LIMIT = BOMBCLIENT_STATS_HANDLER_LIMIT;
+
+    HandlerStats     m_HandlerStats[STATS_HANDLER_LIMIT];
+    uint8_t          m_HandlerStatsCount;
+    LatencyStats     m_CommandStats[NET_COMMAND_MAX];
+#endif
+
     public:
         BombClient();
 
-        Promise* ReadPacket();
-        Promise* WritePacket(void* data, size_t size, bool freeData = false);
+        void ReadPacket();
+        void WritePacket(void* data, size_t size, bool freeData = false);
+
+        //the link to the server, I2C unless set before Attach
+        inline void SetTransport(comm::Transport* link) {
+            m_I2C.SetTransport(link);
+        }
 
         void Attach(int address);
 
+        inline void SetAcceptedEvents(uint32_t eventMask) {
+            m_AcceptedEvents = eventMask;
+        }
+
+        //Posted events of these types are skipped when a newer one of the same type is already queued
+        inline void SetCoalescedEvents(uint32_t eventMask) {
+            m_CoalescedEvents = eventMask;
+        }
+
         template<typename T, typename F>
         void AddEventDispatcher(F disp, T* param) {
             void(*func)(uint8_t, void*, T*) = static_cast<void(*)(uint8_t, void*, T*)>(disp);
@@ -140,14 +333,18 @@ private:
 
         void DispatchEvent();
 
+        void DispatchEventBatch();
+
         void RespondToHandshake();
 
+        void RespondWithStats();
+
         inline bool IsAllSyncDone() {
             return m_RequestQueueAlloc == 0;
         }
 
-        inline uint32_t BitMask(int i) {
-            return (1ull << (uint32_t)i);
+        inline RequestMask BitMask(int i) {
+            return (RequestMask) 1 << i;
         }
 
         void HandleResponse();
@@ -156,50 +353,108 @@ private:
 
         void FlushRequests();
 
-        size_t GetAvailableRequestId();
+        size_t GetAvailableRequestId(bool critical = false);
+
+        void SetRequestPolicy(IDHASH handlerId, RequestPolicy policy);
 
         template <typename Resp, template <typename> typename Req, typename RespHnd, typename P>
-        void QueueRequest(const char* handlerName, Req<Resp>* params, size_t paramsSize, RespHnd handleResponse, P* handleRespParam = nullptr) {
-            size_t allocIndex = GetAvailableRequestId();
-            if (allocIndex != REQUEST_POOL_FULL) {
-                void(*func)(Resp*, P*) = static_cast<void(*)(Resp*, P*)>(handleResponse);
-                InsertRequest(allocIndex, handlerName, static_cast<void*>(params), paramsSize, reinterpret_cast<void(*)(void*, void*)>(func), static_cast<void*>(handleRespParam));
-            }
+        void QueueRequest(IDHASH handlerId, Req<Resp>* params, size_t paramsSize, RespHnd handleResponse, P* handleRespParam = nullptr) {
+            void(*func)(Resp*, P*) = static_cast<void(*)(Resp*, P*)>(handleResponse);
+            InsertRequest(handlerId, static_cast<void*>(params), paramsSize, reinterpret_cast<void(*)(void*, void*)>(func), static_cast<void*>(handleRespParam));
         }
 
         template <typename Resp, template <typename> typename Req, typename RespHnd, typename P>
-        void QueueRequest(const char* handlerName, Req<Resp>* params, RespHnd handleResponse, P* handleRespParam = nullptr) {
-            QueueRequest(handlerName, params, sizeof(Req<Resp>), handleResponse, handleRespParam);
+        void QueueRequest(IDHASH handlerId, Req<Resp>* params, RespHnd handleResponse, P* handleRespParam = nullptr) {
+            QueueRequest(handlerId, params, sizeof(Req<Resp>), handleResponse, handleRespParam);
         }
 
         template <typename Resp, typename Req, typename RespHnd>
-        void QueueRequest(const char* handlerName, Req* params, RespHnd handleResponse) {
-            size_t allocIndex = GetAvailableRequestId();
-            if (allocIndex != REQUEST_POOL_FULL) {
-                void(*func)(Resp*) = static_cast<void(*)(Resp*)>(handleResponse);
-                InsertRequest(allocIndex, handlerName, static_cast<void*>(params), sizeof(Req), reinterpret_cast<void(*)(void*, void*)>(func), nullptr);
-            }
+        void QueueRequest(IDHASH handlerId, Req* params, RespHnd handleResponse) {
+            void(*func)(Resp*) = static_cast<void(*)(Resp*)>(handleResponse);
+            InsertRequest(handlerId, static_cast<void*>(params), sizeof(Req), reinterpret_cast<void(*)(void*, void*)>(func), nullptr);
         }
 
         template<typename Req>
-        void QueueRequest(const char* handlerName, Req* params, size_t paramsSize) {
-            size_t allocIndex = GetAvailableRequestId();
-            if (allocIndex != REQUEST_POOL_FULL) {
-                InsertRequest(allocIndex, handlerName, static_cast<void*>(params), paramsSize, nullptr, nullptr);
-            }
+        void QueueRequest(IDHASH handlerId, Req* params, size_t paramsSize) {
+            InsertRequest(handlerId, static_cast<void*>(params), paramsSize, nullptr, nullptr);
         }
 
         template<typename Req>
-        void QueueRequest(const char* handlerName, Req* params) {
-            QueueRequest(handlerName, params, sizeof(Req));
+        void QueueRequest(IDHASH handlerId, Req* params) {
+            QueueRequest(handlerId, params, sizeof(Req));
         }
 
-        void QueueRequest(const char* handlerName);
+        void QueueRequest(IDHASH handlerId);
         
         void DiscardRequests();
+
+        //the transport carries nothing the link has started before this, for when the bus has been reset
+        inline void ResetLink() {
+            m_I2C.Reset();
+        }
+
+        inline uint16_t GetTransferCancelCount() {
+            return m_I2C.GetCancelledTransfers();
+        }
+
+        inline uint32_t GetReclaimedBytes() {
+            return m_I2C.GetReclaimedBytes();
+        }
+
+        inline uint16_t GetArenaDropCount() {
+            return m_I2C.GetArenaDrops();
+        }
     
     private:
-        void InsertRequest(size_t id, const char* handlerName, void* params, size_t paramSize, void(*responseHandler)(void*, void*), void* handleRespParam);
+        static void OnPrologRead(BombClient* client, NetPacketProlog* prolog);
+
+        static void OnContentsRead(BombClient* client, NetCommandPacket* command);
+
+        void ClosePacket(NetCommandPacket* packet);
+
+        void FreeWrittenContexts();
+
+        void EnqueueCommand(NetCommandPacket* command);
+
+        bool IsCoalesced(NetCommandPacket* command);
+
+        bool IsSuperseded(NetCommandPacket* command);
+
+        uint8_t GetStatus();
+
+        void CountLinkError();
+
+        void DispatchEventRecord(uint8_t eventId, void* eventData);
+
+        bool IsEventAccepted(uint8_t eventId);
+
+        size_t GetParamsSize(NetCommandPacket* packet);
+
+        size_t GetCurrentParamsSize();
+
+        void LoadOpcodeTable(const char* table, size_t size);
+
+        uint8_t GetOpcode(IDHASH handlerId);
+
+        static size_t GetVarintSize(uint16_t value);
+
+        static char* WriteVarint(char* out, uint16_t value);
+
+        RequestPolicy GetRequestPolicy(IDHASH handlerId);
+
+        HandlerStats* GetHandlerStats(IDHASH handlerId);
+
+        size_t FindPendingRequest(IDHASH handlerId);
+
+        void ReleaseRequestParams(size_t id);
+
+        void ExpireRequests();
+
+        static uint8_t CountBits(RequestMask mask);
+
+        char* WriteRequest(char* out, size_t id);
+
+        void InsertRequest(IDHASH handlerId, void* params, size_t paramSize, void(*responseHandler)(void*, void*), void* handleRespParam);
 };
 
 #endif
\ No newline at end of file
@@ -127,11 +127,13 @@ void DefusableModule::Defuse() {
 void DefusableModule::Strike() {
     GetModuleLedDriver()->TurnOn(0xFF0000);
     game::Event<ModuleLedDriver>* turnOff = game::CreateWaitEvent<ModuleLedDriver>(1000);
-    turnOff->Then(new game::Event<ModuleLedDriver>(function(game::Event<ModuleLedDriver>* e, ModuleLedDriver* drv) {
-        drv->TurnOff();
-        return true;
-    }));
-    m_LightEvents->Start(turnOff);
+    if (turnOff) {
+        turnOff->Then(new game::Event<ModuleLedDriver>(function(game::Event<ModuleLedDriver>* e, ModuleLedDriver* drv) {
+            drv->TurnOff();
+            return true;
+        }));
+        m_LightEvents->Start(turnOff);
+    }
     m_Bomb->Strike();
 }
 
@@ -145,7 +147,7 @@ static bool FlashConfigLedEvent(game::Event<ModuleLedDriver>* e, ModuleLedDriver
     }
     e
     ->Then(game::CreateWaitEvent<ModuleLedDriver>(500))
-    ->Then(new game::Event<ModuleLedDriver>(FlashConfigLedEvent, new bool{!on}));
+    ->ThenWithData(FlashConfigLedEvent, !on);
     return true;
 }
 
@@ -156,14 +158,13 @@ struct EventModuleLedScheduleParam {
 
 void DefusableModule::OnEvent(uint8_t id, void* data) {
     if (id == bconf::CONFIG_LIGHT) {
-        //Inside ISR - ensure atomicity
-        auto param = new EventModuleLedScheduleParam{
+        EventModuleLedScheduleParam param{
             *static_cast<uint8_t*>(data) == 1,
             this  
         };
-        game::Event<ModuleLedDriver>* sched = new game::Event<ModuleLedDriver>(function(game::Event<ModuleLedDriver>* e, ModuleLedDriver* drv, EventModuleLedScheduleParam* data) {
+        game::Event<ModuleLedDriver>* sched = game::Event<ModuleLedDriver>::WithData(function(game::Event<ModuleLedDriver>* e, ModuleLedDriver* drv, EventModuleLedScheduleParam* data) {
             if (data->m_On) {
-                e->Then(FlashConfigLedEvent, new bool{true});
+                e->ThenWithData(FlashConfigLedEvent, true);
                 drv->TurnOn(0x0000FF);
             }
             else {
@@ -171,7 +172,7 @@ void DefusableModule::OnEvent(uint8_t id, void* data) {
             }
             return true;
         }, param);
-        if (!m_LightEventQueue->QueueExclusive(sched, m_LightMutex)) {
+        if (sched && !m_LightEventQueue->QueueExclusive(sched, m_LightMutex)) {
             delete sched;
         }
     }
@@ -1,5 +1,15 @@
 #include "BombConfig.h"
 
+/*
+The server writes a config the way the AVR holds it in memory: packed, with 16-bit sizes and pointers given as offsets
+from the start of the config. On the AVR it is relocated where it is. A host build has wider, aligned fields,
+so it unpacks a copy instead, which lasts until the next config of the same kind is unpacked.
+*/
+#if __SIZEOF_POINTER__ == 2
+
+static_assert(sizeof(ConfigVariable) == 9 && sizeof(ModuleConfig) == 4, "Module config does not match what the server writes");
+static_assert(sizeof(BombConfig) == 33 && sizeof(BombConfig::Module) == 7, "Bomb config does not match what the server writes");
+
 static void RelocatePointer(void* pptr, void* base) {
     void** _pptr = static_cast<void**>(pptr);
     void* ptr = *_pptr;
@@ -30,6 +40,124 @@ BombConfig* BombConfig::FromBuffer(void* buffer) {
     return cfg;
 }
 
+#else
+
+//offsets and sizes of the AVR layout
+static constexpr size_t WIRE_VARIABLE_SIZE = 9;
+static constexpr size_t WIRE_BOMB_ARRAYS = 17;
+static constexpr size_t WIRE_MODULE_SIZE = 7;
+static constexpr size_t WIRE_LABEL_SIZE = 5;
+static constexpr size_t WIRE_PORT_SIZE = 4;
+static constexpr size_t WIRE_BATTERY_SIZE = 2;
+
+static void* s_ModuleConfigCopy;
+static void* s_BombConfigCopy;
+
+static uint16_t WireU16(const uint8_t* p) {
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t WireU32(const uint8_t* p) {
+    return WireU16(p) | ((uint32_t) WireU16(p + 2) << 16);
+}
+
+static void* ReplaceCopy(void** copy, size_t size) {
+    free(*copy);
+    *copy = calloc(1, size);
+    return *copy;
+}
+
+ModuleConfig* ModuleConfig::FromBuffer(void* buffer) {
+    //count, offset of the variables
+    const uint8_t* wire = static_cast<const uint8_t*>(buffer);
+    size_t count = WireU16(wire);
+    const uint8_t* in = wire + WireU16(wire + 2);
+
+    ModuleConfig* cfg = static_cast<ModuleConfig*>(ReplaceCopy(&s_ModuleConfigCopy, sizeof(ModuleConfig) + count * sizeof(ConfigVariable)));
+    ConfigVariable* vars = reinterpret_cast<ConfigVariable*>(cfg + 1);
+    for (size_t i = 0; i < count; i++, in += WIRE_VARIABLE_SIZE) {
+        //name, type, then a 4 byte union
+        vars[i].Name = WireU32(in);
+        vars[i].Type = static_cast<ConfigVariableType>(in[4]);
+        const uint8_t* value = in + 5;
+        switch (vars[i].Type) {
+            case VAR_STR:
+            case VAR_STR_ENUM:
+                vars[i].StringValue = reinterpret_cast<const char*>(wire + WireU16(value));
+                break;
+            case VAR_INT:
+                vars[i].IntValue = WireU16(value);
+                break;
+            case VAR_LONG:
+                vars[i].LongValue = WireU32(value);
+                break;
+            case VAR_BOOL:
+                vars[i].BoolValue = value[0];
+                break;
+            default:
+                break;
+        }
+    }
+    cfg->Variables.Set(vars, count);
+    return cfg;
+}
+
+BombConfig* BombConfig::FromBuffer(void* buffer) {
+    const uint8_t* wire = static_cast<const uint8_t*>(buffer);
+    //count and offset of the modules, labels, ports and batteries
+    const uint8_t* arrays = wire + WIRE_BOMB_ARRAYS;
+    size_t moduleCount = WireU16(arrays);
+    size_t labelCount = WireU16(arrays + 4);
+    size_t portCount = WireU16(arrays + 8);
+    size_t batteryCount = WireU16(arrays + 12);
+
+    //one block, in order of alignment
+    size_t size = sizeof(BombConfig) + moduleCount * sizeof(Module) + labelCount * sizeof(Label) + portCount * sizeof(Port) + batteryCount * sizeof(Battery);
+    BombConfig* cfg = static_cast<BombConfig*>(ReplaceCopy(&s_BombConfigCopy, size));
+    cfg->RandomSeed = WireU32(wire);
+    memcpy(cfg->SerialNo, wire + 4, SERIAL_NUMBER_LENGTH);
+    cfg->SerialFlags = static_cast<SerialFlag>(WireU16(wire + 10));
+    cfg->MaxStrikes = wire[12];
+    cfg->TimeLimit = static_cast<bombclock_t>(WireU32(wire + 13));
+
+    Module* modules = reinterpret_cast<Module*>(cfg + 1);
+    const uint8_t* in = wire + WireU16(arrays + 2);
+    for (size_t i = 0; i < moduleCount; i++, in += WIRE_MODULE_SIZE) {
+        modules[i].Name = WireU32(in);
+        modules[i].Flags = static_cast<ModuleFlag>(in[4]);
+        uint16_t extra = WireU16(in + 5);
+        modules[i].ExtraData = extra ? const_cast<uint8_t*>(wire + extra) : nullptr;
+    }
+
+    Label* labels = reinterpret_cast<Label*>(modules + moduleCount);
+    in = wire + WireU16(arrays + 6);
+    for (size_t i = 0; i < labelCount; i++, in += WIRE_LABEL_SIZE) {
+        labels[i].Name = WireU32(in);
+        labels[i].IsLit = in[4];
+    }
+
+    Port* ports = reinterpret_cast<Port*>(labels + labelCount);
+    in = wire + WireU16(arrays + 10);
+    for (size_t i = 0; i < portCount; i++, in += WIRE_PORT_SIZE) {
+        ports[i].Name = WireU32(in);
+    }
+
+    Battery* batteries = reinterpret_cast<Battery*>(ports + portCount);
+    in = wire + WireU16(arrays + 14);
+    for (size_t i = 0; i < batteryCount; i++, in += WIRE_BATTERY_SIZE) {
+        batteries[i].Count = in[0];
+        batteries[i].Size = in[1];
+    }
+
+    cfg->Modules.Set(modules, moduleCount);
+    cfg->Labels.Set(labels, labelCount);
+    cfg->Ports.Set(ports, portCount);
+    cfg->Batteries.Set(batteries, batteryCount);
+    return cfg;
+}
+
+#endif
+
 int BombConfig::BatteryCount() {
     int cnt = 0;
     for (size_t i = 0; i < Batteries.Size(); i++) {
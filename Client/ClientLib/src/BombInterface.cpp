@@ -17,6 +17,15 @@ BombInterface::BombInterface(BombClient* client, bconf::SyncFlag syncFlags)
     client->AddEventDispatcher(function(uint8_t eventId, void* eventData, BombInterface* iface) {
         iface->OnEvent(eventId, eventData);
     }, this);
+    //a newer sync makes the queued one pointless
+    client->SetRequestPolicy(HASHID("GetStrikes"), BombClient::REQUEST_REPLACE_PENDING);
+    //the game depends on these, diagnostics must not crowd them out
+    client->SetRequestPolicy(HASHID("AddStrike"), BombClient::REQUEST_CRITICAL);
+    client->SetRequestPolicy(HASHID("DefuseComponent"), BombClient::REQUEST_CRITICAL);
+    client->SetRequestPolicy(HASHID("AckReadyToArm"), BombClient::REQUEST_CRITICAL);
+    //a module cannot arm without its configuration, a response lost on the way is asked for again
+    client->SetRequestPolicy(HASHID("GetBombConfig"), BombClient::REQUEST_RETRY);
+    client->SetRequestPolicy(HASHID("GetComponentConfigByBusAddress"), BombClient::REQUEST_RETRY);
 }
 
 void BombInterface::OnEvent(uint8_t eventId, void* eventData) {
@@ -28,20 +37,19 @@ void BombInterface::OnEvent(uint8_t eventId, void* eventData) {
         case bconf::STRIKE:
             SyncStrikes();
             break;
+        case bconf::ARM:
         case bconf::TIMER_SYNC:
-            SyncGameClock();
+            SyncGameClock(static_cast<bprotocol::ClockSyncEvent*>(eventData));
             break;
     }
 }
 
 void BombInterface::LoadBombConfig(BombComponent* module) {
     bprotocol::ConfigRequest req;
-    m_Client->QueueRequest("GetBombConfig", &req, function(bprotocol::ConfigResponse* resp, BombComponent* module) {
-        void* buffer = malloc(resp->m_BufferSize);
-        memcpy(buffer, resp->m_Buffer, resp->m_BufferSize);
-        BombConfig* conf = BombConfig::FromBuffer(buffer);
+    m_Client->QueueRequest(HASHID("GetBombConfig"), &req, function(bprotocol::ConfigResponse* resp, BombComponent* module) {
+        //relocated inside the received packet, which is only released once we return
+        BombConfig* conf = BombConfig::FromBuffer(resp->m_Buffer);
         module->LoadConfiguration(conf);
-        free(buffer);
         module->m_BombConfigDone = true;
         module->m_Bomb->AckReadyIfModuleConfigured(module);
     }, module);
@@ -51,13 +59,10 @@ bool BombInterface::IsAllSyncDone() {
     return m_Client->IsAllSyncDone();
 }
 
-void BombInterface::SyncGameClock() {
-    bprotocol::SimpleRequest<bprotocol::ClockResponse> req;
-    m_Client->QueueRequest("GetClock", &req, function(bprotocol::ClockResponse* resp, BombInterface* iface) {
-        iface->m_State.ClockSyncTime = millis();
-        iface->UpdateClockValue(resp->m_Clock - CLOCK_SYNC_CORRECTION);
-        iface->m_State.Timescale = resp->m_Timescale;
-    }, this);
+void BombInterface::SyncGameClock(const bprotocol::ClockSyncEvent* sync) {
+    m_State.ClockSyncTime = millis();
+    UpdateClockValue(sync->m_Clock);
+    m_State.Timescale = sync->m_Timescale;
 }
 
 bombclock_t BombInterface::GetBombTime() {
@@ -96,7 +101,7 @@ void BombInterface::GetTimerDigits(uint8_t* dest) {
 
 void BombInterface::SyncStrikes() {
     bprotocol::SimpleRequest<uint8_t> req;
-    m_Client->QueueRequest("GetStrikes", &req, function(uint8_t* resp, BombInterface* iface) {
+    m_Client->QueueRequest(HASHID("GetStrikes"), &req, function(uint8_t* resp, BombInterface* iface) {
         iface->m_State.Strikes = *resp;
     }, this);
 }
@@ -107,9 +112,9 @@ int BombInterface::GetStrikes() {
 
 void BombInterface::LoadComponentConfig(BombComponent* component) {
     bprotocol::ConfigRequest req;
-    m_Client->QueueRequest("GetComponentConfigByBusAddress", &req, function(bprotocol::ConfigResponse* resp, BombComponent* component) {
-        void* buffer = malloc(resp->m_BufferSize);
-        memcpy(buffer, resp->m_Buffer, resp->m_BufferSize);
+    m_Client->QueueRequest(HASHID("GetComponentConfigByBusAddress"), &req, function(bprotocol::ConfigResponse* resp, BombComponent* component) {
+        //relocated inside the received packet, which is only released once we return
+        void* buffer = resp->m_Buffer;
         component->LoadConfiguration(buffer);
         #ifdef DEBUG
         Serial.print("Component config bytes after relocation:");
@@ -119,14 +124,13 @@ void BombInterface::LoadComponentConfig(BombComponent* component) {
         }
         Serial.println();
         #endif
-        free(buffer);
         component->m_ModuleConfigDone = true;
         component->m_Bomb->AckReadyIfModuleConfigured(component);
     }, component);
 }
 
 void BombInterface::AckReady() {
-    m_Client->QueueRequest("AckReadyToArm");
+    m_Client->QueueRequest(HASHID("AckReadyToArm"));
 }
 
 void BombInterface::AckReadyIfModuleConfigured(BombComponent* mod) {
@@ -139,11 +143,11 @@ void BombInterface::AckReadyIfModuleConfigured(BombComponent* mod) {
 }
 
 void BombInterface::Strike() {
-    m_Client->QueueRequest("AddStrike");
+    m_Client->QueueRequest(HASHID("AddStrike"));
 }
 
 void BombInterface::DefuseMe() {
-    m_Client->QueueRequest("DefuseComponent");
+    m_Client->QueueRequest(HASHID("DefuseComponent"));
 }
 
 void BombInterface::SendServerMessage(bprotocol::ServerMessageType type, const char* text, bool progMem) {
@@ -153,7 +157,7 @@ void BombInterface::SendServerMessage(bprotocol::ServerMessageType type, const c
     req->m_Type = type;
     req->m_Length = len;
     progMem ? memcpy_P(req->m_Text, text, len) : memcpy(req->m_Text, text, len);
-    m_Client->QueueRequest("OutputDebugMessage", req, reqSize);
+    m_Client->QueueRequest(HASHID("OutputDebugMessage"), req, reqSize);
 }
 
 void BombInterface::UpdateClockValue(bombclock_t clock) {
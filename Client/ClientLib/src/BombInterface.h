@@ -16,14 +16,14 @@ namespace bconf {
     enum BombEvent {
         RESET,
         CONFIGURE,
-        ARM,
+        ARM, //carries bprotocol::ClockSyncEvent
         STRIKE,
         EXPLOSION,
         DEFUSAL,
         LIGHTS_OUT,
         LIGHTS_ON,
         TIMER_TICK,
-        TIMER_SYNC, //like TIMER_TICK but less frequent. TIMER_TICK fires every second (!)
+        TIMER_SYNC, //like TIMER_TICK but less frequent, carries bprotocol::ClockSyncEvent. TIMER_TICK fires every second (!)
         CONFIG_LIGHT,
     };
 
@@ -43,6 +43,9 @@ namespace bconf {
 
         LIGHTS_BITS = LIGHTS_OUT_BIT | LIGHTS_ON_BIT,
 
+        //state updates where only the newest one matters when they pile up
+        COALESCED_BITS = TIMER_TICK_BIT | TIMER_SYNC_BIT | LIGHTS_BITS,
+
         ALWAYS_LISTEN_BITS = RESET_BIT | CONFIGURE_BIT | ARM_BIT | EXPLOSION_BIT | DEFUSAL_BIT | CONFIG_LIGHT_BIT
     };
 
@@ -58,8 +61,9 @@ namespace bconf {
 #include "Common.h"
 
 namespace bprotocol {
+    //m_Buffer is relocated in place, so pointers into it are only valid during the response handler
     struct ConfigResponse : BombClient::TResponse {
-        size_t m_BufferSize;
+        uint16_t m_BufferSize;
         char m_Buffer[1];
     };
 
@@ -67,7 +71,8 @@ namespace bprotocol {
 
     };
 
-    struct ClockResponse : BombClient::TResponse {
+    //data of ARM and TIMER_SYNC, taken by the server right before sending
+    struct __attribute__((packed)) ClockSyncEvent {
         bombclock_t m_Clock;
         float m_Timescale;
     };
@@ -81,7 +86,7 @@ namespace bprotocol {
         SRVMSG_ASSERT
     };
 
-    struct ServerMessageRequest : BombClient::TRequest<BombClient::TResponse> {
+    struct __attribute__((packed)) ServerMessageRequest : BombClient::TRequest<BombClient::TResponse> {
         ServerMessageType m_Type;
         uint16_t m_Length;
         char m_Text[1];
@@ -111,8 +116,6 @@ struct BombState {
 
 class BombInterface {
 private:
-    static constexpr int CLOCK_SYNC_CORRECTION = 20; //20ms
-
     bconf::SyncFlag  m_SyncFlags;
 
     BombClient*     m_Client;
@@ -127,7 +130,7 @@ public:
 
     bool IsAllSyncDone();
 
-    void SyncGameClock();
+    void SyncGameClock(const bprotocol::ClockSyncEvent* sync);
     bombclock_t GetBombTime();
     void GetTimerDigits(uint8_t* dest);
 
@@ -19,7 +19,7 @@ void HandleTestResponse(TestResponse* resp, BombClient* cl) {
     PRINTF_P("Response: %s\n", resp->Message);
     TestRequest r;
     memcpy(&r.Message, "ahoj", strlen("ahoj") + 1);
-    cl->QueueRequest<TestResponse>("Test", &r, HandleTestResponse, cl);
+    cl->QueueRequest<TestResponse>(HASHID("Test"), &r, HandleTestResponse, cl);
 }
 
 void setup() {
@@ -29,7 +29,7 @@ void setup() {
     cl.Attach(addr);
     TestRequest r;
     memcpy(&r.Message, "ahoj", strlen("ahoj") + 1);
-    cl.QueueRequest<TestResponse>("Test", &r, HandleTestResponse, &cl);
+    cl.QueueRequest<TestResponse>(HASHID("Test"), &r, HandleTestResponse, &cl);
     puts("Client started.");
 }
 
@@ -15,6 +15,30 @@ typedef int32_t bombclock_t;
 typedef uint32_t IDHASH;
 IDHASH HashID(const char* name);
 
+//FNV-1a like HashID, but evaluated by the compiler
+constexpr IDHASH HashIDConst(const char* name, IDHASH hash = 0x811C9DC5ul) {
+    return *name ? HashIDConst(name + 1, (IDHASH)((hash ^ (unsigned char)*name) * 16777619ul)) : hash;
+}
+
+template<IDHASH H>
+struct IDHashConstant {
+    static constexpr IDHASH Value = H;
+};
+
+//Hash of a string literal as a compile time constant
+#define HASHID(name) (IDHashConstant<HashIDConst(name)>::Value)
+
+//TypeSelect<cond, A, B>::Type is A if cond holds, B otherwise
+template<bool Cond, typename A, typename B>
+struct TypeSelect {
+    typedef A Type;
+};
+
+template<typename A, typename B>
+struct TypeSelect<false, A, B> {
+    typedef B Type;
+};
+
 template<typename T>
 struct FixedArrayRef {
 private:
@@ -33,6 +57,11 @@ public:
     inline T** ArrayPointer() {
         return &Elements;
     }
+
+    inline void Set(T* elements, size_t count) {
+        Elements = elements;
+        Count = count;
+    }
 };
 
 #endif
\ No newline at end of file
@@ -2,6 +2,17 @@
 #include "lambda.h"
 #include "UARTPrint.h"
 #include "ComponentMain.h"
+#include "BlockPool.h"
+
+#ifdef __AVR__
+//everything ClientLib keeps in .bss, the receive arena and the request pool being inside the BombClient
+static constexpr size_t CLIENTLIB_STATIC_RAM = sizeof(ComponentMain)
+    + sizeof(BlockPool<sizeof(game::Event<void>), GAME_EVENT_POOL_SIZE, false>)
+    + sizeof(BlockPool<sizeof(game::EventChain<void>), GAME_EVENT_CHAIN_POOL_SIZE, false>)
+    + sizeof(BlockPool<sizeof(Promise), PROMISE_POOL_SIZE>)
+    + sizeof(comm::I2CReadPromiseQueue::EntryPool) + sizeof(comm::I2CWritePromiseQueue::EntryPool);
+static_assert(CLIENTLIB_STATIC_RAM <= CLIENTLIB_RAM_BUDGET, "ClientLib buffers and pools leave too little RAM for the stack");
+#endif
 
 ComponentMain::ComponentMain() : m_IsArmed{false}, m_RequestedState{StateRequest::NONE} {
 
@@ -37,6 +48,8 @@ void ComponentMain::Setup(BombComponent* module, bool disableSerial) {
         *pSize = allSize;
     }, m_Component);
     m_BombCl.AddEventDispatcher(DoDispatchEvent, this);
+    m_BombCl.SetAcceptedEvents(m_Component->GetAcceptedEvents() | bconf::ALWAYS_LISTEN_BITS);
+    m_BombCl.SetCoalescedEvents(bconf::COALESCED_BITS);
 
     int addr = AddressObtainer::FromAnalogPin(A6);
     PRINTF_P("Address: %d\n", addr);
@@ -90,9 +103,11 @@ void ComponentMain::DispatchEvent(uint8_t id, void* data) {
             break;
         case bconf::BombEvent::RESET:
         case bconf::BombEvent::EXPLOSION:
+            ReportRuntimeStats();
             m_RequestedState = StateRequest::RESET;
             break;
         case bconf::BombEvent::DEFUSAL:
+            ReportRuntimeStats();
             m_RequestedState = StateRequest::STANDBY;
             break;
         case bconf::BombEvent::ARM:
@@ -102,6 +117,22 @@ void ComponentMain::DispatchEvent(uint8_t id, void* data) {
     m_Component->OnEvent(id, data);
 }
 
+void ComponentMain::ReportRuntimeStats() {
+    //once per game, covering everything since the last report
+    PRINTF_P("Longest span with interrupts off: %u us\n", (unsigned int) CriticalSection::GetLongestSpan());
+    CriticalSection::ResetLongestSpan();
+    PRINTF_P("Promise pool high-water %u of %u, %u heap fallbacks\n", (unsigned int) Promise::GetPoolHighWater(), (unsigned int) PROMISE_POOL_SIZE, (unsigned int) Promise::GetPoolFallbackCount());
+    Promise::ResetPoolStats();
+    game::EventPoolStats events = game::GetEventPoolStats();
+    PRINTF_P("Event pool high-water %u of %u, chains %u of %u, %u events and %u chains refused\n",
+        (unsigned int) events.EventHighWater, (unsigned int) GAME_EVENT_POOL_SIZE,
+        (unsigned int) events.ChainHighWater, (unsigned int) GAME_EVENT_CHAIN_POOL_SIZE,
+        (unsigned int) events.EventOverflows, (unsigned int) events.ChainOverflows);
+    game::ResetEventPoolStats();
+    PRINTF_P("Transfers cancelled %u, bytes reclaimed %lu, %u packets dropped by the receive arena\n", (unsigned int) m_BombCl.GetTransferCancelCount(),
+        (unsigned long) m_BombCl.GetReclaimedBytes(), (unsigned int) m_BombCl.GetArenaDropCount());
+}
+
 void ComponentMain::DoDispatchEvent(uint8_t id, void* data, ComponentMain* mm) {
     mm->DispatchEvent(id, data);
 }
@@ -13,6 +13,13 @@
 #define BOMB_ASSERT(expression)
 #endif
 
+//Static RAM that ComponentMain and the ClientLib pools may take on the AVR, checked at compile time in ComponentMain.cpp.
+//Of the 2 KB of an ATmega328 this leaves 640 bytes: about 350 for the Arduino core (Serial and Wire buffers),
+//the rest for the module, the heap and the stack. A module that raises a pool size above its default pays here.
+#ifndef CLIENTLIB_RAM_BUDGET
+#define CLIENTLIB_RAM_BUDGET 1408
+#endif
+
 class ComponentMain {
 private:
     enum class StateRequest {
@@ -34,6 +41,11 @@ public:
 
     static ComponentMain* GetInstance();
 
+    //call before Setup for a link other than I2C
+    inline void SetTransport(comm::Transport* link) {
+        m_BombCl.SetTransport(link);
+    }
+
     void Setup(BombComponent* module, bool disableSerial = false);
 
     void Loop();
@@ -48,6 +60,8 @@ public:
 
 private:
     void AssertFailedPanicLoop();
+
+    void ReportRuntimeStats();
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,65 @@
+#ifndef __CONTINUATION_H
+#define __CONTINUATION_H
+
+/*
+What a transfer queue entry resumes once its bytes are in or out. Unlike Promise, a continuation is not allocated per transfer:
+it lives in the storage of whoever owns the transfer (a member of BombClient, a field of a WriteContext) and can be reused
+as soon as it has run. Resuming it is a single call through a trampoline that knows the handler's types.
+
+A chain of transfers is a continuation per step, each handler starting the next transfer with the next one.
+A transfer that never completes (see AsyncI2C::ExpireTransfers and Reset) cancels its continuation instead,
+so that the owner can free what it was holding for it.
+*/
+class ContinuationBase {
+public:
+    typedef void(*Trampoline)(ContinuationBase* self, void* result);
+
+private:
+    Trampoline m_Resume;
+    Trampoline m_Cancel;
+
+protected:
+    constexpr ContinuationBase(Trampoline resume, Trampoline cancel = nullptr) : m_Resume{resume}, m_Cancel{cancel} {}
+
+public:
+    //result is the buffer read into, or the end of the data written
+    inline void Resume(void* result) {
+        m_Resume(this, result);
+    }
+
+    //the transfer was dropped, any buffer it had has been freed already
+    inline void Cancel() {
+        if (m_Cancel) {
+            m_Cancel(this, nullptr);
+        }
+    }
+};
+
+//Calls handler(context, result), or onCancel(context) if given. The handlers must take exactly these types.
+template<typename C, typename R = void>
+class Continuation : public ContinuationBase {
+public:
+    typedef void(*Handler)(C* context, R* result);
+    typedef void(*CancelHandler)(C* context);
+
+private:
+    C*      m_Context;
+    Handler m_Handler;
+    CancelHandler m_OnCancel;
+
+    static void Invoke(ContinuationBase* self, void* result) {
+        Continuation* c = static_cast<Continuation*>(self);
+        c->m_Handler(c->m_Context, static_cast<R*>(result));
+    }
+
+    static void InvokeCancel(ContinuationBase* self, void* result) {
+        Continuation* c = static_cast<Continuation*>(self);
+        c->m_OnCancel(c->m_Context);
+    }
+
+public:
+    constexpr Continuation(C* context, Handler handler, CancelHandler onCancel = nullptr) :
+        ContinuationBase(Invoke, onCancel ? InvokeCancel : nullptr), m_Context{context}, m_Handler{handler}, m_OnCancel{onCancel} {}
+};
+
+#endif
@@ -0,0 +1,13 @@
+#include "CriticalSection.h"
+
+uint16_t CriticalSection::s_LongestSpanUs = 0;
+
+uint16_t CriticalSection::GetLongestSpan() {
+    CriticalSection cs;
+    return s_LongestSpanUs;
+}
+
+void CriticalSection::ResetLongestSpan() {
+    CriticalSection cs;
+    s_LongestSpanUs = 0;
+}
@@ -0,0 +1,61 @@
+#ifndef __CRITICALSECTION_H
+#define __CRITICALSECTION_H
+
+#include <stdint.h>
+#include "Arduino.h"
+
+/*
+Interrupts are off for the lifetime of a CriticalSection and are restored to what they were before.
+Only state that is also touched by an interrupt handler needs one - see the notes at the top of BombClient.h.
+
+Both critical sections and interrupt handlers (through IsrSpan, in I2CTransport) record how long interrupts were off,
+so that the longest span can be checked against what the I2C hardware and millis() can tolerate.
+*/
+class CriticalSection {
+private:
+    static uint16_t s_LongestSpanUs;
+
+    uint8_t       m_SavedSREG;
+    unsigned long m_Start;
+
+public:
+    //call with interrupts off
+    static inline void RecordSpan(unsigned long start) {
+        unsigned long span = micros() - start;
+        if (span > s_LongestSpanUs) {
+            s_LongestSpanUs = span > 0xFFFF ? 0xFFFF : span;
+        }
+    }
+
+    //measures an interrupt handler, which runs with interrupts off anyway
+    class IsrSpan {
+    private:
+        unsigned long m_Start;
+    public:
+        inline IsrSpan() : m_Start{micros()} {}
+
+        inline ~IsrSpan() {
+            RecordSpan(m_Start);
+        }
+    };
+
+    inline CriticalSection() : m_SavedSREG{SREG} {
+        cli();
+        m_Start = micros();
+    }
+
+    inline ~CriticalSection() {
+        RecordSpan(m_Start);
+        SREG = m_SavedSREG;
+    }
+
+    CriticalSection(const CriticalSection&) = delete;
+    CriticalSection& operator=(const CriticalSection&) = delete;
+
+    //longest time with interrupts off since the last reset, in microseconds
+    static uint16_t GetLongestSpan();
+
+    static void ResetLongestSpan();
+};
+
+#endif
@@ -1,7 +1,36 @@
 #include "GameEvent.h"
+#include "BlockPool.h"
 
 namespace game {
     #ifdef EVENT_DEBUG
     int g_EventInstCount{0};
     #endif
-}
\ No newline at end of file
+
+    static BlockPool<sizeof(Event<void>), GAME_EVENT_POOL_SIZE, false> g_EventPool;
+    static BlockPool<sizeof(EventChain<void>), GAME_EVENT_CHAIN_POOL_SIZE, false> g_EventChainPool;
+
+    void* AllocEvent(size_t size) noexcept {
+        return g_EventPool.Alloc(size);
+    }
+
+    void FreeEvent(void* ptr) {
+        g_EventPool.Free(ptr);
+    }
+
+    void* AllocEventChain(size_t size) noexcept {
+        return g_EventChainPool.Alloc(size);
+    }
+
+    void FreeEventChain(void* ptr) {
+        g_EventChainPool.Free(ptr);
+    }
+
+    EventPoolStats GetEventPoolStats() {
+        return EventPoolStats{g_EventPool.GetHighWater(), g_EventChainPool.GetHighWater(), g_EventPool.GetOverflowCount(), g_EventChainPool.GetOverflowCount()};
+    }
+
+    void ResetEventPoolStats() {
+        g_EventPool.ResetStats();
+        g_EventChainPool.ResetStats();
+    }
+}
@@ -1,12 +1,30 @@
 #ifndef __GAMEEVENT_H
 #define __GAMEEVENT_H
 
+#include <string.h>
 #include "Arduino.h"
-#include "util/atomic.h"
 #include "lambda.h"
+#include "RingBuffer.h"
+#include "UARTPrint.h"
 
 //#define EVENT_DEBUG
 
+//Events and event chains that can be alive at once, shared by every EventManager. There is no heap fallback:
+//new Event yields nullptr when the pool is empty, a chain that lost an event to it does not Start.
+#ifndef GAME_EVENT_POOL_SIZE
+#define GAME_EVENT_POOL_SIZE 12
+#endif
+
+#ifndef GAME_EVENT_CHAIN_POOL_SIZE
+#define GAME_EVENT_CHAIN_POOL_SIZE 6
+#endif
+
+//Data given to Event::WithData up to this size lives inside the event, larger data in a heap block of its own.
+//Room for the deadline and duration of a wait event, 8 bytes on the AVR.
+#ifndef GAME_EVENT_INLINE_DATA_SIZE
+#define GAME_EVENT_INLINE_DATA_SIZE (2 * sizeof(unsigned long))
+#endif
+
 namespace game {
     template<typename C>
     struct EventChain;
@@ -23,6 +41,22 @@ namespace game {
     extern int g_EventInstCount;
     #endif
 
+    //Blocks for every Event<C> and EventChain<C>, which have the same layout whatever C is, see GameEvent.cpp
+    void* AllocEvent(size_t size) noexcept;
+    void FreeEvent(void* ptr);
+    void* AllocEventChain(size_t size) noexcept;
+    void FreeEventChain(void* ptr);
+
+    struct EventPoolStats {
+        uint8_t EventHighWater;
+        uint8_t ChainHighWater;
+        uint16_t EventOverflows;
+        uint16_t ChainOverflows;
+    };
+
+    EventPoolStats GetEventPoolStats();
+    void ResetEventPoolStats();
+
     template<typename C>
     class Event {
         friend class EventManager<C>;
@@ -31,10 +65,30 @@ namespace game {
         EventFunc m_Func;
         void* m_Data;
         bool m_FreeData;
+        bool m_Broken{false}; //an event after this one could not be allocated
         Event* m_Next;
 
         EventChain<C>* m_Chain;
 
+        alignas(max_align_t) uint8_t m_Inline[GAME_EVENT_INLINE_DATA_SIZE];
+
+        bool IsChainBroken() const {
+            for (const Event* e = this; e; e = e->m_Next) {
+                if (e->m_Broken) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        static void DeleteChain(Event* e) {
+            while (e) {
+                Event* next = e->m_Next;
+                delete e;
+                e = next;
+            }
+        }
+
         bool Update(void* container) {
             if (!m_Func) {
                 return true;
@@ -51,6 +105,14 @@ namespace game {
         }
     
     public:
+        static void* operator new(size_t size) noexcept {
+            return AllocEvent(size);
+        }
+
+        static void operator delete(void* ptr) {
+            FreeEvent(ptr);
+        }
+
         template<typename F, typename D>
         Event(F func, D* data) : m_Data{static_cast<void*>(data)}, m_Next{nullptr} {
             bool(*_func)(Event*, C*, D*) = static_cast<bool(*)(Event*, C*, D*)>(func);
@@ -76,6 +138,31 @@ namespace game {
             #endif
         }
 
+        //a copy of data is handed to func, inside the event when it fits, so small payloads need no allocation of their own
+        template<typename F, typename D>
+        static Event* WithData(F func, const D& data) {
+            static_assert(__is_trivially_copyable(D), "Event data is copied bytewise and never destructed");
+            bool fits = sizeof(D) <= GAME_EVENT_INLINE_DATA_SIZE;
+            D* block = nullptr;
+            if (!fits) {
+                block = static_cast<D*>(malloc(sizeof(D)));
+                if (!block) {
+                    return nullptr;
+                }
+            }
+            Event* event = new Event(func, block);
+            if (!event) {
+                free(block);
+                return nullptr;
+            }
+            if (fits) {
+                event->m_Data = event->m_Inline;
+                event->m_FreeData = false;
+            }
+            memcpy(event->m_Data, &data, sizeof(D));
+            return event;
+        }
+
         Event* SetDataPermanent() {
             m_FreeData = false;
             return this;
@@ -83,15 +170,33 @@ namespace game {
 
         template<typename F, typename D>
         Event* Then(F func, D* data) {
-            return Then(new Event(func, data));
+            Event* next = new Event(func, data);
+            if (!next) {
+                delete data; //owned by the event that could not be made
+            }
+            return Then(next);
         }
 
         template<typename F>
         Event* Then(F func) {
             return Then(new Event(func));
         }
+
+        template<typename F, typename D>
+        Event* ThenWithData(F func, const D& data) {
+            return Then(WithData(func, data));
+        }
     
+        //A nullptr from an empty pool, or a chain that is broken itself, is refused: the chain is freed, this event marked
+        //broken and returned, so the rest of a Then chain still builds. A chain not started yet then does not Start,
+        //one that is running goes on without it - check IsBroken to tell.
         Event* Then(Event* nextEvent) {
+            if (!nextEvent || nextEvent->IsChainBroken()) {
+                PRINTLN_P("Event pool full!");
+                DeleteChain(nextEvent);
+                m_Broken = true;
+                return this;
+            }
             Event* oldnext = m_Next;
             m_Next = nextEvent;
             nextEvent->m_Chain = m_Chain;
@@ -106,6 +211,11 @@ namespace game {
             return nextEvent;
         }
 
+        //whether a Then on this event was refused
+        bool IsBroken() const {
+            return m_Broken;
+        }
+
         void Cancel() {
             m_Chain->Cancel();
         }
@@ -113,16 +223,17 @@ namespace game {
 
     template<typename C>
     Event<C>* CreateWaitEvent(long ms) {
-        unsigned long* data = new unsigned long[2];
-        data[0] = 0;
-        data[1] = ms;
-        return new Event<C>(function(Event<C>* e, C* context, unsigned long* data) {
+        struct WaitData {
+            unsigned long Deadline;
+            unsigned long Duration;
+        };
+        return Event<C>::WithData(function(Event<C>* e, C* context, WaitData* data) {
             unsigned long time = millis();
-            if (!data[0]) {
-                data[0] = time + data[1];
+            if (!data->Deadline) {
+                data->Deadline = time + data->Duration;
             }
-            return time >= data[0];
-        }, data);
+            return time >= data->Deadline;
+        }, WaitData{0, (unsigned long) ms});
     }
 
     template<typename C>
@@ -142,6 +253,11 @@ namespace game {
             SetChain(nullptr, nullptr);
         }
 
+        //started and neither finished nor cancelled yet
+        bool IsRunning() const {
+            return m_Chain != nullptr;
+        }
+
     private:
         void SetChain(EventManager<C>* mgr, EventChain<C>* chain) {
             m_Mgr = mgr;
@@ -168,9 +284,15 @@ namespace game {
             
         }
 
+        //returns the last event of the chain, or nullptr when it was not started for lack of pooled blocks
         Event<C>* Start(Event<C>* event, EventChainHandle<C>* handle = nullptr) {
             if (event) {
-                EventChain<C>* chain = new EventChain<C>(event);
+                EventChain<C>* chain = event->IsChainBroken() ? nullptr : new EventChain<C>(event);
+                if (!chain) {
+                    PRINTLN_P("Event chain not started, pool full!");
+                    Event<C>::DeleteChain(event);
+                    return nullptr;
+                }
                 chain->m_Next = m_Events;
                 chain->m_Handle = handle;
                 
@@ -271,6 +393,14 @@ namespace game {
         EventChain* m_Next{nullptr};
         EventChainHandle<C>* m_Handle{nullptr};
 
+        static void* operator new(size_t size) noexcept {
+            return AllocEventChain(size);
+        }
+
+        static void operator delete(void* ptr) {
+            FreeEventChain(ptr);
+        }
+
         EventChain(Event<C>* event) {
             m_CurEvent = event;
         }
@@ -292,79 +422,65 @@ namespace game {
         }
     };
 
-    template<typename C>
+    //Events to be started by the next Execute. One context queues, one executes, neither disables interrupts.
+    template<typename C, size_t size = 8>
     class EventQueue {
     public:
         struct Mutex {
             friend class EventQueue;
         private:
-            bool m_On;
+            volatile bool m_On;
         public:
             Mutex() : m_On{false} {
 
             }
         };
     private:
-        struct Node {
+        struct Entry {
             Event<C>* m_Event;
             Mutex* m_Mutex;
-            Node* m_Next;
-
-            ~Node() {
-                m_Mutex->m_On = false;
-            }
         };
 
         EventManager<C>* m_EventMgr;
         
-        Node* m_EventHead;
-        Node* m_EventTail;
+        RingBuffer<Entry, size> m_Entries;
+
+        static void Release(const Entry& entry) {
+            if (entry.m_Mutex) {
+                entry.m_Mutex->m_On = false;
+            }
+        }
     
     public:
-        EventQueue(EventManager<C>* mgr) : m_EventHead{nullptr}, m_EventTail{nullptr} {
+        EventQueue(EventManager<C>* mgr) {
             m_EventMgr = mgr;
         }
 
         void Clear() {
-            Node* n = m_EventHead;
-            while (n) {
-                Node* next = n->m_Next;
-                delete n->m_Event;
-                delete n;
-                n = next;
+            while (m_Entries.HasNext()) {
+                Entry entry = m_Entries.Pop();
+                delete entry.m_Event;
+                Release(entry);
             }
-            m_EventHead = nullptr;
-            m_EventTail = nullptr;
         }
 
         void Execute() {
-            ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
-                Node* n = m_EventHead;
-                while (n) {
-                    Node* next = n->m_Next;
-                    m_EventMgr->Start(n->m_Event);
-                    delete n;
-                    n = next;
-                }
-                m_EventHead = nullptr;
-                m_EventTail = nullptr;
-            }
-        }
-    private:
-        void InsertNode(Node* n) {
-            if (!m_EventHead) {
-                m_EventHead = n;
-            }
-            else {
-                m_EventTail->m_Next = n;
+            Entry batch[size];
+            size_t count = m_Entries.Pop(batch, size);
+            for (size_t i = 0; i < count; i++) {
+                m_EventMgr->Start(batch[i].m_Event);
+                Release(batch[i]);
             }
-            m_EventTail = n;
         }
-    public:
+
         Event<C>* Queue(Event<C>* event) {
-            ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
-                Node* n = new Node{event, nullptr, nullptr};
-                InsertNode(n);
+            if (!event) {
+                return nullptr;
+            }
+            if (!m_Entries.Push(Entry{event, nullptr})) {
+                PRINTLN_P("Event queue full!");
+                delete event;
+                return nullptr;
             }
             return event;
         }
@@ -379,16 +495,17 @@ namespace game {
             return Queue(new Event<C>(func));
         }
 
+        //only the executing side clears the mutex, so the check cannot race with it
         bool QueueExclusive(Event<C>* event, Mutex& mutex) {
-            ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
-                if (!mutex.m_On) {
-                    mutex.m_On = true;
-                    Node* n = new Node{event, &mutex, nullptr};
-                    InsertNode(n);
-                    return true;
-                }
+            if (!event || mutex.m_On) {
+                return false;
             }
-            return false;
+            mutex.m_On = true;
+            if (!m_Entries.Push(Entry{event, &mutex})) {
+                mutex.m_On = false;
+                return false;
+            }
+            return true;
         }
     };
 }
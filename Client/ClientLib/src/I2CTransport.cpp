@@ -0,0 +1,68 @@
+#include "Arduino.h"
+#include "Wire.h"
+#include "lambda.h"
+#include "CriticalSection.h"
+#include "I2CTransport.h"
+
+namespace comm {
+
+    I2CTransport* I2CTransport::s_Instance = nullptr;
+
+    I2CTransport::I2CTransport() {
+
+    }
+
+    I2CTransport* I2CTransport::GetInstance() {
+        static I2CTransport _inst;
+
+        return &_inst;
+    }
+
+    void I2CTransport::Begin(uint8_t address) {
+        s_Instance = this;
+        //the handlers are the TWI interrupt, they count towards the longest span with interrupts off
+        Wire.onRequest(function() {
+            CriticalSection::IsrSpan span;
+            I2CTransport* t = s_Instance;
+            if (t->m_OnRequest) {
+                t->m_OnRequest(t->m_HandlerParam);
+            }
+        });
+        Wire.onReceive(function(int n) {
+            CriticalSection::IsrSpan span;
+            I2CTransport* t = s_Instance;
+            size_t bytes = (size_t) Wire.available();
+            if (bytes && t->m_OnReceive) {
+                t->m_OnReceive(bytes, t->m_HandlerParam);
+            }
+        });
+        Wire.begin(address);
+        //Wire has no interface for this - also receive writes to the general call address
+        TWAR |= _BV(TWGCE);
+    }
+
+    size_t I2CTransport::Available() {
+        return Wire.available();
+    }
+
+    int I2CTransport::Read() {
+        return Wire.read();
+    }
+
+    int I2CTransport::Peek() {
+        return Wire.peek();
+    }
+
+    size_t I2CTransport::Read(void* dest, size_t size) {
+        return Wire.readBytes(static_cast<uint8_t*>(dest), size);
+    }
+
+    size_t I2CTransport::GetRequestSize() {
+        //the slave does not learn how much the master reads, only that it stops - this is all Wire can send
+        return BUFFER_LENGTH;
+    }
+
+    size_t I2CTransport::Write(const void* data, size_t size) {
+        return Wire.write(static_cast<const uint8_t*>(data), size);
+    }
+}
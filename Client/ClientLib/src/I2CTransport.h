@@ -0,0 +1,30 @@
+#ifndef __I2CTRANSPORT_H
+#define __I2CTRANSPORT_H
+
+#include "Transport.h"
+
+namespace comm {
+
+    //TWI slave on the Wire library. The handlers run in the TWI interrupt.
+    class I2CTransport : public Transport {
+    private:
+        static I2CTransport* s_Instance; //Wire callbacks take no parameter
+
+        I2CTransport();
+
+    public:
+        static I2CTransport* GetInstance();
+
+        void Begin(uint8_t address) override;
+
+        size_t Available() override;
+        int Read() override;
+        int Peek() override;
+        size_t Read(void* dest, size_t size) override;
+
+        size_t GetRequestSize() override;
+        size_t Write(const void* data, size_t size) override;
+    };
+}
+
+#endif
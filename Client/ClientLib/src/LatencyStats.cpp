@@ -0,0 +1,52 @@
+#include "Arduino.h"
+#include "LatencyStats.h"
+#include <string.h>
+
+void LatencyStats::Reset() {
+    m_Count = 0;
+    m_Min = 0xFFFF;
+    m_Max = 0;
+    m_Sum = 0;
+    memset(m_Buckets, 0, sizeof(m_Buckets));
+}
+
+uint8_t LatencyStats::GetBucket(uint16_t ms) {
+    uint8_t bucket = 0;
+    ms >>= 1;
+    while (ms && bucket < BUCKET_COUNT - 1) {
+        ms >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+void LatencyStats::Add(uint16_t ms) {
+    if (m_Count == 0xFFFF) {
+        m_Count >>= 1;
+        m_Sum >>= 1;
+    }
+    m_Count++;
+    m_Sum += ms;
+    if (ms < m_Min) {
+        m_Min = ms;
+    }
+    if (ms > m_Max) {
+        m_Max = ms;
+    }
+
+    uint8_t bucket = GetBucket(ms);
+    if (m_Buckets[bucket] == 0xFF) {
+        for (uint8_t i = 0; i < BUCKET_COUNT; i++) {
+            m_Buckets[i] >>= 1;
+        }
+    }
+    m_Buckets[bucket]++;
+}
+
+void LatencyStats::Write(Record* out) const {
+    out->Count = m_Count;
+    out->Min = m_Count ? m_Min : 0;
+    out->Max = m_Max;
+    out->Mean = m_Count ? m_Sum / m_Count : 0;
+    memcpy(out->Buckets, m_Buckets, sizeof(m_Buckets));
+}
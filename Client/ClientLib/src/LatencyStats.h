@@ -0,0 +1,56 @@
+#ifndef __LATENCYSTATS_H
+#define __LATENCYSTATS_H
+
+#include "Arduino.h"
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+Minimum, maximum, mean and a power-of-two histogram of latencies in milliseconds.
+Bucket i holds latencies below 2 << i ms, the last one everything above. The counters halve when one would overflow,
+so that a module that runs for hours keeps the shape of its distribution.
+*/
+class LatencyStats {
+public:
+    static constexpr uint8_t BUCKET_COUNT = 8; //<2, <4, <8 ... <128, the rest
+
+    //what the server reads in a STATS response
+    struct __attribute__((packed)) Record {
+        uint16_t Count;
+        uint16_t Min;
+        uint16_t Max;
+        uint16_t Mean;
+        uint8_t  Buckets[BUCKET_COUNT];
+    };
+
+private:
+    uint16_t m_Count;
+    uint16_t m_Min;
+    uint16_t m_Max;
+    uint32_t m_Sum;
+    uint8_t  m_Buckets[BUCKET_COUNT];
+
+    static uint8_t GetBucket(uint16_t ms);
+
+public:
+    inline LatencyStats() {
+        Reset();
+    }
+
+    void Reset();
+
+    void Add(uint16_t ms);
+
+    void Write(Record* out) const;
+
+    //milliseconds since a timestamp taken with Now, for latencies below a minute
+    static inline uint16_t Now() {
+        return (uint16_t) millis();
+    }
+
+    static inline uint16_t Since(uint16_t timestamp) {
+        return (uint16_t) (Now() - timestamp);
+    }
+};
+
+#endif
@@ -3,6 +3,44 @@
 #endif
 
 #include "Promise.h"
+#include "BlockPool.h"
+
+//EmptyPromise only overrides methods, so both fit the same block
+static BlockPool<sizeof(Promise), PROMISE_POOL_SIZE> g_PromisePool;
+static_assert(sizeof(EmptyPromise) <= sizeof(Promise), "Promise pool blocks too small");
+
+void* PromiseStub::operator new(size_t size) {
+    return g_PromisePool.Alloc(size);
+}
+
+void PromiseStub::operator delete(void* ptr) {
+    g_PromisePool.Free(ptr);
+}
+
+uint8_t PromiseStub::GetPoolHighWater() {
+    return g_PromisePool.GetHighWater();
+}
+
+uint16_t PromiseStub::GetPoolFallbackCount() {
+    return g_PromisePool.GetOverflowCount();
+}
+
+void PromiseStub::ResetPoolStats() {
+    g_PromisePool.ResetStats();
+}
+
+PromiseStub::PromiseStub() : ContinuationBase(ResumePromise, CancelPromise) {
+
+}
+
+void PromiseStub::ResumePromise(ContinuationBase* self, void* result) {
+    static_cast<PromiseStub*>(self)->Resolve(result);
+}
+
+void PromiseStub::CancelPromise(ContinuationBase* self, void* result) {
+    //only Promise and its subclasses are ever queued
+    static_cast<Promise*>(static_cast<PromiseStub*>(self))->Reject();
+}
 
 PromiseStub::~PromiseStub() {
 
@@ -1,16 +1,40 @@
 #ifndef __PROMISE_H
 #define __PROMISE_H
 
+#include <stddef.h>
+#include <stdint.h>
 #include "DebugPrint.h"
+#include "Continuation.h"
+
+//Promises that can be alive at once without touching the heap, see BlockPool.h.
+//BombClient runs on continuations, only the AsyncI2C calls that return a Promise take one.
+#ifndef PROMISE_POOL_SIZE
+#define PROMISE_POOL_SIZE 2
+#endif
 
 class Promise;
 
-class PromiseStub {
+//The heap-linked, dynamically chained way to continue a transfer. Queues resume it like any other continuation.
+class PromiseStub : public ContinuationBase {
 public:
     typedef PromiseStub*(*ResolveHandler)(void*, void*);
+
+    //every promise comes from the promise pool, the reads and writes of a game should not need malloc
+    static void* operator new(size_t size);
+    static void operator delete(void* ptr);
+
+    static uint8_t GetPoolHighWater();
+    static uint16_t GetPoolFallbackCount();
+    static void ResetPoolStats();
 protected:
+    PromiseStub();
+
     virtual ~PromiseStub();
 
+    static void ResumePromise(ContinuationBase* self, void* result);
+
+    static void CancelPromise(ContinuationBase* self, void* result);
+
     virtual void Resolve(void* resp);
     virtual void OnEnqueued(void* lastResp);
 
@@ -62,6 +86,7 @@ public:
 
     void Resolve(void* resp) override;
 
+    //drops this promise and everything chained after it without calling their handlers
     void Reject();
 };
 
@@ -2,41 +2,88 @@
 #define __RINGBUFFER_H
 
 #include <stddef.h>
+#include <stdint.h>
 
+/*
+Single producer, single consumer queue. One side may run in an interrupt while the other runs in the main loop
+without any critical section: the producer only ever writes m_Head, the consumer only ever writes m_Tail,
+and a slot is published or given back only after it has been written or read.
+
+The indices run freely and are masked on access, so all of the capacity is usable and no full flag is shared.
+They are single bytes, which the AVR loads and stores in one instruction.
+*/
 template<typename T, size_t size>
 class RingBuffer {
 private:
-    T      m_Data[size];
-    size_t m_WritePos{0};
-    size_t m_ReadPos{0};
-    bool   m_Full{false};
+    static_assert(size && (size & (size - 1)) == 0, "Ring buffer size must be a power of two");
+    static_assert(size <= 128, "Ring buffer indices are 8 bits");
+
+    static constexpr uint8_t MASK = size - 1;
+
+    T       m_Data[size];
+    uint8_t m_Head{0}; //written by the producer
+    uint8_t m_Tail{0}; //written by the consumer
+
+    static inline uint8_t Load(const uint8_t& index) {
+        return __atomic_load_n(&index, __ATOMIC_ACQUIRE);
+    }
+
+    static inline void Store(uint8_t& index, uint8_t value) {
+        __atomic_store_n(&index, value, __ATOMIC_RELEASE);
+    }
 
 public:
-    inline bool HasNext() {
-        return m_ReadPos != m_WritePos || m_Full;
+    static constexpr size_t CAPACITY = size;
+
+    //either side, a snapshot that only the other side can make stale
+    inline size_t Count() const {
+        return (uint8_t) (Load(m_Head) - Load(m_Tail));
     }
 
-    bool Push(T element) {
-        if (m_Full) {
+    inline bool HasNext() const {
+        return Load(m_Head) != Load(m_Tail);
+    }
+
+    //producer side
+
+    bool Push(const T& element) {
+        uint8_t head = m_Head;
+        if ((uint8_t) (head - Load(m_Tail)) == size) {
             return false;
         }
-        m_Data[m_WritePos++] = element;
-        if (m_WritePos == size) {
-            m_WritePos = 0;
-        }
-        if (m_WritePos == m_ReadPos) {
-            m_Full = true;
-        }
+        m_Data[head & MASK] = element;
+        Store(m_Head, head + 1);
         return true;
     }
 
-    T& Pop() {
-        T& retval = m_Data[m_ReadPos++];
-        if (m_ReadPos == size) {
-            m_ReadPos = 0;
-        }
+    //consumer side
+
+    //i-th element from the next one to be popped, i < Count()
+    inline T& Peek(size_t i) {
+        return m_Data[(uint8_t) (m_Tail + i) & MASK];
+    }
+
+    //the slot is handed back to the producer, so the element is returned by value
+    T Pop() {
+        uint8_t tail = m_Tail;
+        T retval = m_Data[tail & MASK];
+        Store(m_Tail, tail + 1);
         return retval;
     }
+
+    //pops up to max elements into out, returns how many
+    size_t Pop(T* out, size_t max) {
+        uint8_t tail = m_Tail;
+        size_t count = (uint8_t) (Load(m_Head) - tail);
+        if (count > max) {
+            count = max;
+        }
+        for (size_t i = 0; i < count; i++) {
+            out[i] = m_Data[(uint8_t) (tail + i) & MASK];
+        }
+        Store(m_Tail, tail + count);
+        return count;
+    }
 };
 
-#endif
\ No newline at end of file
+#endif
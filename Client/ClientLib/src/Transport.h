@@ -0,0 +1,60 @@
+#ifndef __TRANSPORT_H
+#define __TRANSPORT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace comm {
+
+    /*
+    The link to the server, seen from the slave side: the master writes to us and reads from us, we never start a transfer.
+
+    A write from the master is handed to the receive handler, which takes the bytes with Read/Peek.
+    A read from the master is a request to send, the request handler answers it with Write.
+    Both handlers run in an interrupt on links that have one (I2C), or from Poll in the main loop.
+    */
+    class Transport {
+    public:
+        typedef void(*ReceiveHandler)(size_t available, void* param);
+        typedef void(*RequestHandler)(void* param);
+
+    protected:
+        ReceiveHandler m_OnReceive;
+        RequestHandler m_OnRequest;
+        void*          m_HandlerParam;
+
+    public:
+        Transport() : m_OnReceive{nullptr}, m_OnRequest{nullptr}, m_HandlerParam{nullptr} {}
+
+        inline void SetHandlers(ReceiveHandler onReceive, RequestHandler onRequest, void* param) {
+            m_OnReceive = onReceive;
+            m_OnRequest = onRequest;
+            m_HandlerParam = param;
+        }
+
+        //starts listening on the given address, writes to the broadcast address are received too
+        virtual void Begin(uint8_t address) = 0;
+
+        //services links without an interrupt, called every loop
+        virtual void Poll() {}
+
+        //In the receive handler
+
+        virtual size_t Available() = 0;
+        virtual int Read() = 0;
+        virtual int Peek() = 0;
+        virtual size_t Read(void* dest, size_t size) = 0;
+
+        //In the request handler
+
+        //bytes the master still reads in this request, or the most it can read if the link does not tell
+        virtual size_t GetRequestSize() = 0;
+        virtual size_t Write(const void* data, size_t size) = 0;
+
+        inline size_t Write(uint8_t data) {
+            return Write(&data, 1);
+        }
+    };
+}
+
+#endif
@@ -4,6 +4,11 @@
 #include <stdio.h>
 #include "Arduino.h"
 
+#ifdef ARDUINO_NATIVE
+//stdout already is the console on the host
+#define DISABLE_SERIAL_PRINT
+#endif
+
 //https://playground.arduino.cc/Main/Printf/
 
 void print_init(unsigned long baud);
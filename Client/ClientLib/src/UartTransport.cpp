@@ -0,0 +1,130 @@
+#include "UartTransport.h"
+
+namespace comm {
+
+    UartTransport::UartTransport(HardwareSerial* serial, unsigned long baud, uint8_t driverEnablePin) :
+        m_Serial{serial}, m_Baud{baud}, m_DriverEnablePin{driverEnablePin}, m_Address{0},
+        m_State{FrameState::COMMAND}, m_FrameCommand{0}, m_FrameForUs{false}, m_FrameLength{0}, m_LastByteTime{0},
+        m_RxLength{0}, m_RxIndex{0}, m_TxRemaining{0} {
+
+    }
+
+    void UartTransport::Begin(uint8_t address) {
+        m_Address = address;
+        pinMode(m_DriverEnablePin, OUTPUT);
+        digitalWrite(m_DriverEnablePin, LOW);
+        m_Serial->begin(m_Baud);
+    }
+
+    void UartTransport::Poll() {
+        if (!m_Serial->available()) {
+            //bytes that wait for a slow loop are not a pause, so only an empty receive buffer counts
+            if (m_State != FrameState::COMMAND && millis() - m_LastByteTime > UART_TRANSPORT_FRAME_TIMEOUT) {
+                m_State = FrameState::COMMAND;
+            }
+            return;
+        }
+        while (m_Serial->available()) {
+            m_LastByteTime = millis();
+
+            uint8_t b = m_Serial->read();
+            switch (m_State) {
+                case FrameState::COMMAND:
+                    if (b == FRAME_WRITE || b == FRAME_READ) {
+                        m_FrameCommand = b;
+                        m_State = FrameState::ADDRESS;
+                    }
+                    break;
+                case FrameState::ADDRESS:
+                    m_FrameForUs = b == m_Address || (b == BROADCAST_ADDRESS && m_FrameCommand == FRAME_WRITE);
+                    m_State = FrameState::LENGTH;
+                    break;
+                case FrameState::LENGTH:
+                    m_FrameLength = b;
+                    m_RxLength = 0;
+                    OnFrameHeader();
+                    break;
+                case FrameState::DATA:
+                    if (m_FrameForUs && m_RxLength < MAX_FRAME) {
+                        m_RxBuffer[m_RxLength] = b;
+                    }
+                    m_RxLength++;
+                    if (m_RxLength == m_FrameLength) {
+                        m_State = FrameState::COMMAND;
+                        if (m_FrameForUs && m_OnReceive && m_FrameLength <= MAX_FRAME) {
+                            m_RxIndex = 0;
+                            m_OnReceive(m_RxLength, m_HandlerParam);
+                        }
+                        m_RxLength = 0;
+                    }
+                    break;
+                case FrameState::SKIP:
+                    if (++m_RxLength == m_FrameLength) {
+                        m_State = FrameState::COMMAND;
+                        m_RxLength = 0;
+                    }
+                    break;
+            }
+        }
+    }
+
+    void UartTransport::OnFrameHeader() {
+        if (m_FrameCommand == FRAME_WRITE) {
+            m_State = m_FrameLength ? FrameState::DATA : FrameState::COMMAND;
+            return;
+        }
+        if (m_FrameForUs) {
+            m_State = FrameState::COMMAND;
+            AnswerRead(); //we do not hear ourselves
+        }
+        else {
+            //an answer byte could pass for a frame header, and make us answer a read meant for nobody
+            m_State = m_FrameLength ? FrameState::SKIP : FrameState::COMMAND;
+        }
+    }
+
+    void UartTransport::AnswerRead() {
+        m_TxRemaining = m_FrameLength;
+        digitalWrite(m_DriverEnablePin, HIGH);
+        if (m_OnRequest) {
+            m_OnRequest(m_HandlerParam);
+        }
+        while (m_TxRemaining) {
+            m_Serial->write((uint8_t) 0xFF);
+            m_TxRemaining--;
+        }
+        //the driver may only be released once the last stop bit is out
+        m_Serial->flush();
+        digitalWrite(m_DriverEnablePin, LOW);
+    }
+
+    size_t UartTransport::Available() {
+        return m_RxLength - m_RxIndex;
+    }
+
+    int UartTransport::Read() {
+        return m_RxIndex < m_RxLength ? m_RxBuffer[m_RxIndex++] : -1;
+    }
+
+    int UartTransport::Peek() {
+        return m_RxIndex < m_RxLength ? m_RxBuffer[m_RxIndex] : -1;
+    }
+
+    size_t UartTransport::Read(void* dest, size_t size) {
+        size_t count = min(size, Available());
+        memcpy(dest, m_RxBuffer + m_RxIndex, count);
+        m_RxIndex += count;
+        return count;
+    }
+
+    size_t UartTransport::GetRequestSize() {
+        return m_TxRemaining;
+    }
+
+    size_t UartTransport::Write(const void* data, size_t size) {
+        size_t count = min(size, (size_t) m_TxRemaining);
+        m_Serial->write(static_cast<const uint8_t*>(data), count);
+        m_TxRemaining -= count;
+        return count;
+    }
+}
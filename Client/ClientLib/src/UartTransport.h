@@ -0,0 +1,82 @@
+#ifndef __UARTTRANSPORT_H
+#define __UARTTRANSPORT_H
+
+#include "Arduino.h"
+#include "Transport.h"
+
+//Largest frame, in either direction. The master must not write or read more at once.
+#ifndef UART_TRANSPORT_MAX_FRAME
+#define UART_TRANSPORT_MAX_FRAME 64
+#endif
+
+//A pause this long between two bytes of a frame drops it, so that a lost byte does not desync the rest
+#ifndef UART_TRANSPORT_FRAME_TIMEOUT
+#define UART_TRANSPORT_FRAME_TIMEOUT 5
+#endif
+
+namespace comm {
+
+    /*
+    Half-duplex serial link for RS-485 transceivers, where a bus of modules may run faster and further than I2C.
+    The master frames every transfer the way the I2C hardware would:
+        'W' addr len data[len] - master write, not acknowledged
+        'R' addr len           - master read, the addressed slave answers with exactly len bytes (0xFF past what it had)
+    Address 0 is the broadcast address, which is written to but never read.
+    Every slave hears the answers of the others, which are skipped by their length rather than parsed as frames.
+    The driver enable pin is high only while we answer a read. Tie the receiver enable to it, so that we do not hear ourselves.
+
+    The handlers run from Poll in the main loop. If the serial port is also the debug console, disable printing.
+    */
+    class UartTransport : public Transport {
+    public:
+        static constexpr uint8_t FRAME_WRITE = 'W';
+        static constexpr uint8_t FRAME_READ = 'R';
+        static constexpr uint8_t BROADCAST_ADDRESS = 0;
+        static constexpr size_t MAX_FRAME = UART_TRANSPORT_MAX_FRAME;
+
+    private:
+        enum class FrameState : uint8_t {
+            COMMAND,
+            ADDRESS,
+            LENGTH,
+            DATA,
+            SKIP //the answer of another slave to a read
+        };
+
+        HardwareSerial* m_Serial;
+        unsigned long   m_Baud;
+        uint8_t         m_DriverEnablePin;
+        uint8_t         m_Address;
+
+        FrameState      m_State;
+        uint8_t         m_FrameCommand;
+        bool            m_FrameForUs;
+        uint8_t         m_FrameLength;
+        unsigned long   m_LastByteTime;
+
+        uint8_t         m_RxBuffer[MAX_FRAME];
+        uint8_t         m_RxLength;
+        uint8_t         m_RxIndex;
+
+        uint8_t         m_TxRemaining;
+
+        void OnFrameHeader();
+        void AnswerRead();
+
+    public:
+        UartTransport(HardwareSerial* serial, unsigned long baud, uint8_t driverEnablePin);
+
+        void Begin(uint8_t address) override;
+        void Poll() override;
+
+        size_t Available() override;
+        int Read() override;
+        int Peek() override;
+        size_t Read(void* dest, size_t size) override;
+
+        size_t GetRequestSize() override;
+        size_t Write(const void* data, size_t size) override;
+    };
+}
+
+#endif
@@ -0,0 +1,126 @@
+#include "UnixSocketTransport.h"
+
+#ifdef ARDUINO_NATIVE
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <errno.h>
+#include <string.h>
+#include "Wire.h"
+
+namespace comm {
+
+    UnixSocketTransport::UnixSocketTransport(int fd) :
+        m_Fd{fd}, m_Address{0}, m_RxLength{0}, m_RxIndex{0}, m_TxLength{0}, m_TxLimit{0} {
+
+    }
+
+    void UnixSocketTransport::Begin(uint8_t address) {
+        m_Address = address;
+        native::SetBusService(Service, this);
+    }
+
+    bool UnixSocketTransport::IsAddressed(uint8_t address, bool read) {
+        return address == m_Address || (address == TwoWire::GENERAL_CALL_ADDRESS && !read);
+    }
+
+    void UnixSocketTransport::HandleFrame(const uint8_t* frame, size_t size) {
+        if (size < 2) {
+            return;
+        }
+        uint8_t reply[1 + MAX_FRAME];
+        size_t replySize;
+
+        uint8_t saveSREG = SREG;
+        cli();
+        switch (frame[0]) {
+            case TwoWire::FRAME_WRITE:
+                reply[0] = TwoWire::FRAME_ACK;
+                reply[1] = IsAddressed(frame[1], false);
+                replySize = 2;
+                if (reply[1]) {
+                    m_RxLength = min(size - 2, MAX_FRAME);
+                    m_RxIndex = 0;
+                    memcpy(m_RxBuffer, frame + 2, m_RxLength);
+                    if (m_RxLength && m_OnReceive) {
+                        m_OnReceive(m_RxLength, m_HandlerParam);
+                    }
+                    m_RxLength = 0;
+                }
+                break;
+            case TwoWire::FRAME_READ: {
+                size_t len = min((size > 2) ? (size_t) frame[2] : 1, MAX_FRAME);
+                m_TxLength = 0;
+                m_TxLimit = len;
+                if (IsAddressed(frame[1], true) && m_OnRequest) {
+                    m_OnRequest(m_HandlerParam);
+                }
+                m_TxLimit = 0;
+                reply[0] = TwoWire::FRAME_DATA;
+                memcpy(reply + 1, m_TxBuffer, m_TxLength);
+                memset(reply + 1 + m_TxLength, 0xFF, len - m_TxLength);
+                replySize = len + 1;
+                break;
+            }
+            default:
+                SREG = saveSREG;
+                return;
+        }
+        SREG = saveSREG;
+
+        while (send(m_Fd, reply, replySize, 0) < 0 && errno == EINTR) {}
+    }
+
+    bool UnixSocketTransport::Service(int timeoutMs, void* param) {
+        UnixSocketTransport* t = static_cast<UnixSocketTransport*>(param);
+        if (!(SREG & _BV(SREG_I))) {
+            return true; //the master waits until interrupts are back on
+        }
+        pollfd pfd {t->m_Fd, POLLIN, 0};
+        int ready;
+        while ((ready = poll(&pfd, 1, timeoutMs)) < 0 && errno == EINTR) {}
+        if (ready <= 0) {
+            return true;
+        }
+        uint8_t frame[2 + MAX_FRAME + 1];
+        ssize_t size;
+        while ((size = recv(t->m_Fd, frame, sizeof(frame), 0)) < 0 && errno == EINTR) {}
+        if (size <= 0) {
+            return false;
+        }
+        t->HandleFrame(frame, (size_t) size);
+        return true;
+    }
+
+    size_t UnixSocketTransport::Available() {
+        return m_RxLength - m_RxIndex;
+    }
+
+    int UnixSocketTransport::Read() {
+        return m_RxIndex < m_RxLength ? m_RxBuffer[m_RxIndex++] : -1;
+    }
+
+    int UnixSocketTransport::Peek() {
+        return m_RxIndex < m_RxLength ? m_RxBuffer[m_RxIndex] : -1;
+    }
+
+    size_t UnixSocketTransport::Read(void* dest, size_t size) {
+        size_t count = min(size, Available());
+        memcpy(dest, m_RxBuffer + m_RxIndex, count);
+        m_RxIndex += count;
+        return count;
+    }
+
+    size_t UnixSocketTransport::GetRequestSize() {
+        return m_TxLimit - m_TxLength;
+    }
+
+    size_t UnixSocketTransport::Write(const void* data, size_t size) {
+        size_t count = min(size, m_TxLimit - m_TxLength);
+        memcpy(m_TxBuffer + m_TxLength, data, count);
+        m_TxLength += count;
+        return count;
+    }
+}
+
+#endif
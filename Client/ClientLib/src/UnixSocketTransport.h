@@ -0,0 +1,56 @@
+#ifndef __UNIXSOCKETTRANSPORT_H
+#define __UNIXSOCKETTRANSPORT_H
+
+#include "Arduino.h"
+
+#ifdef ARDUINO_NATIVE
+
+#include "Transport.h"
+
+namespace comm {
+
+    /*
+    Host-only link for testing the protocol stack at whatever speed the machine manages.
+    It speaks the frames of the simulated Wire bus (see Libs/ArduinoNative/src/Wire.h) on a SOCK_SEQPACKET socket,
+    but without the 32 byte limit of the TWI driver, so the master may read and write up to MAX_FRAME bytes at once.
+    The handlers run as simulated interrupts, whenever the sketch services the bus.
+    */
+    class UnixSocketTransport : public Transport {
+    public:
+        static constexpr size_t MAX_FRAME = 255;
+
+    private:
+        int      m_Fd;
+        uint8_t  m_Address;
+
+        uint8_t  m_RxBuffer[MAX_FRAME];
+        size_t   m_RxLength;
+        size_t   m_RxIndex;
+
+        uint8_t  m_TxBuffer[MAX_FRAME];
+        size_t   m_TxLength;
+        size_t   m_TxLimit;
+
+        bool IsAddressed(uint8_t address, bool read);
+        void HandleFrame(const uint8_t* frame, size_t size);
+
+        static bool Service(int timeoutMs, void* param);
+
+    public:
+        explicit UnixSocketTransport(int fd);
+
+        void Begin(uint8_t address) override;
+
+        size_t Available() override;
+        int Read() override;
+        int Peek() override;
+        size_t Read(void* dest, size_t size) override;
+
+        size_t GetRequestSize() override;
+        size_t Write(const void* data, size_t size) override;
+    };
+}
+
+#endif
+
+#endif
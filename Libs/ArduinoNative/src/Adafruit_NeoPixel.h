@@ -0,0 +1,115 @@
+#ifndef __ADAFRUIT_NEOPIXEL_H
+#define __ADAFRUIT_NEOPIXEL_H
+
+#include "Arduino.h"
+
+#define NEO_RGB ((0 << 6) | (0 << 4) | (1 << 2) | (2))
+#define NEO_GRB ((1 << 6) | (1 << 4) | (0 << 2) | (2))
+#define NEO_KHZ800 0x0000
+#define NEO_KHZ400 0x0100
+
+typedef uint16_t neoPixelType;
+
+//Keeps the pixel colors in memory so that a host program can inspect them
+class Adafruit_NeoPixel {
+private:
+    uint16_t  m_NumLEDs;
+    int16_t   m_Pin;
+    uint8_t   m_Brightness;
+    uint32_t* m_Pixels;
+
+public:
+    Adafruit_NeoPixel(uint16_t n = 0, int16_t pin = 6, neoPixelType type = NEO_GRB + NEO_KHZ800) :
+        m_NumLEDs{0}, m_Pin{pin}, m_Brightness{0}, m_Pixels{nullptr} {
+        updateLength(n);
+        updateType(type);
+    }
+
+    ~Adafruit_NeoPixel() {
+        free(m_Pixels);
+    }
+
+    Adafruit_NeoPixel(const Adafruit_NeoPixel&) = delete;
+    Adafruit_NeoPixel& operator=(const Adafruit_NeoPixel&) = delete;
+
+    void begin() {}
+    void show() {}
+
+    bool canShow() const {
+        return true;
+    }
+
+    void setPin(int16_t pin) {
+        m_Pin = pin;
+    }
+
+    void updateLength(uint16_t n) {
+        free(m_Pixels);
+        m_Pixels = n ? static_cast<uint32_t*>(calloc(n, sizeof(uint32_t))) : nullptr;
+        m_NumLEDs = m_Pixels ? n : 0;
+    }
+
+    void updateType(neoPixelType type) {
+        (void) type;
+    }
+
+    void setPixelColor(uint16_t n, uint32_t c) {
+        if (n < m_NumLEDs) {
+            m_Pixels[n] = c;
+        }
+    }
+
+    void setPixelColor(uint16_t n, uint8_t r, uint8_t g, uint8_t b) {
+        setPixelColor(n, Color(r, g, b));
+    }
+
+    void setPixelColor(uint16_t n, uint8_t r, uint8_t g, uint8_t b, uint8_t w) {
+        setPixelColor(n, Color(r, g, b, w));
+    }
+
+    //count 0 fills up to the end of the strip
+    void fill(uint32_t c = 0, uint16_t first = 0, uint16_t count = 0) {
+        if (first >= m_NumLEDs) {
+            return;
+        }
+        uint16_t end = (!count || count > m_NumLEDs - first) ? m_NumLEDs : first + count;
+        for (uint16_t i = first; i < end; i++) {
+            m_Pixels[i] = c;
+        }
+    }
+
+    uint32_t getPixelColor(uint16_t n) const {
+        return n < m_NumLEDs ? m_Pixels[n] : 0;
+    }
+
+    void clear() {
+        fill(0);
+    }
+
+    //kept, not applied to the stored colors
+    void setBrightness(uint8_t b) {
+        m_Brightness = b;
+    }
+
+    uint8_t getBrightness() const {
+        return m_Brightness;
+    }
+
+    uint16_t numPixels() const {
+        return m_NumLEDs;
+    }
+
+    int16_t getPin() const {
+        return m_Pin;
+    }
+
+    static uint32_t Color(uint8_t r, uint8_t g, uint8_t b) {
+        return ((uint32_t) r << 16) | ((uint32_t) g << 8) | b;
+    }
+
+    static uint32_t Color(uint8_t r, uint8_t g, uint8_t b, uint8_t w) {
+        return ((uint32_t) w << 24) | Color(r, g, b);
+    }
+};
+
+#endif
@@ -0,0 +1,297 @@
+#include <time.h>
+#include <unistd.h>
+
+#include "Arduino.h"
+#include "Wire.h"
+
+volatile uint8_t SREG = 0;
+volatile uint8_t TWAR = 0;
+
+HardwareSerial Serial;
+
+static uint8_t g_PinModes[NUM_PINS];
+static uint8_t g_PinLevels[NUM_PINS];
+static int     g_AnalogValues[NUM_PINS];
+
+static uint64_t g_StartMicros;
+
+static uint64_t MonotonicMicros() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+static bool g_BusOpen = true;
+
+static bool(*g_BusService)(int timeoutMs, void* param) = nullptr;
+static void* g_BusServiceParam = nullptr;
+
+static void ServiceBus(int timeoutMs) {
+    if (g_BusOpen) {
+        g_BusOpen = g_BusService ? g_BusService(timeoutMs, g_BusServiceParam) : Wire.Service(timeoutMs);
+    }
+}
+
+//Pins
+
+void pinMode(uint8_t pin, uint8_t mode) {
+    if (pin >= NUM_PINS) {
+        return;
+    }
+    g_PinModes[pin] = mode;
+    if (mode == INPUT_PULLUP) {
+        g_PinLevels[pin] = HIGH;
+    }
+}
+
+void digitalWrite(uint8_t pin, uint8_t val) {
+    if (pin < NUM_PINS) {
+        g_PinLevels[pin] = val ? HIGH : LOW;
+    }
+}
+
+int digitalRead(uint8_t pin) {
+    return pin < NUM_PINS ? g_PinLevels[pin] : LOW;
+}
+
+int analogRead(uint8_t pin) {
+    return pin < NUM_PINS ? g_AnalogValues[pin] : 0;
+}
+
+void analogWrite(uint8_t pin, int val) {
+    digitalWrite(pin, val >= 128);
+}
+
+void tone(uint8_t pin, unsigned int frequency, unsigned long duration) {
+    (void) pin;
+    (void) frequency;
+    (void) duration;
+}
+
+void noTone(uint8_t pin) {
+    (void) pin;
+}
+
+//Time
+
+unsigned long millis() {
+    return (unsigned long) ((MonotonicMicros() - g_StartMicros) / 1000);
+}
+
+unsigned long micros() {
+    return (unsigned long) (MonotonicMicros() - g_StartMicros);
+}
+
+void delay(unsigned long ms) {
+    uint64_t end = MonotonicMicros() + ms * 1000ull;
+    uint64_t now;
+    //keep taking I2C interrupts while waiting
+    while ((now = MonotonicMicros()) < end) {
+        int left = (int) ((end - now + 999) / 1000);
+        if (g_BusOpen) {
+            ServiceBus(left);
+        }
+        else {
+            usleep(end - now);
+        }
+    }
+}
+
+void delayMicroseconds(unsigned int us) {
+    usleep(us);
+}
+
+//Math
+
+long random(long howbig) {
+    if (howbig == 0) {
+        return 0;
+    }
+    return ::random() % howbig;
+}
+
+long random(long howsmall, long howbig) {
+    if (howsmall >= howbig) {
+        return howsmall;
+    }
+    return random(howbig - howsmall) + howsmall;
+}
+
+void randomSeed(unsigned long seed) {
+    if (seed != 0) {
+        srandom(seed);
+    }
+}
+
+//Serial
+
+HardwareSerial::HardwareSerial() : m_InputHead{0}, m_InputCount{0}, m_Output{nullptr}, m_OutputParam{nullptr} {
+
+}
+
+void HardwareSerial::begin(unsigned long baud) {
+    (void) baud;
+}
+
+void HardwareSerial::flush() {
+    if (!m_Output) {
+        fflush(stdout);
+    }
+}
+
+size_t HardwareSerial::Feed(const uint8_t* data, size_t size) {
+    //what does not fit is lost, like an overrun receive buffer
+    size_t count = min(size, INPUT_SIZE - m_InputCount);
+    for (size_t i = 0; i < count; i++) {
+        m_Input[(m_InputHead + m_InputCount++) % INPUT_SIZE] = data[i];
+    }
+    return count;
+}
+
+void HardwareSerial::SetOutput(OutputHandler output, void* param) {
+    m_Output = output;
+    m_OutputParam = param;
+}
+
+int HardwareSerial::available() {
+    return (int) m_InputCount;
+}
+
+int HardwareSerial::read() {
+    if (!m_InputCount) {
+        return -1;
+    }
+    uint8_t b = m_Input[m_InputHead];
+    m_InputHead = (m_InputHead + 1) % INPUT_SIZE;
+    m_InputCount--;
+    return b;
+}
+
+int HardwareSerial::peek() {
+    return m_InputCount ? m_Input[m_InputHead] : -1;
+}
+
+size_t HardwareSerial::write(uint8_t c) {
+    return write(&c, 1);
+}
+
+size_t HardwareSerial::write(const char* str) {
+    return write(reinterpret_cast<const uint8_t*>(str), strlen(str));
+}
+
+size_t HardwareSerial::write(const uint8_t* buffer, size_t size) {
+    if (m_Output) {
+        m_Output(buffer, size, m_OutputParam);
+        return size;
+    }
+    return fwrite(buffer, 1, size, stdout);
+}
+
+size_t HardwareSerial::print(const char* str) {
+    return write(str);
+}
+
+size_t HardwareSerial::print(char c) {
+    return write((uint8_t) c);
+}
+
+size_t HardwareSerial::print(int n, int base) {
+    return print((long) n, base);
+}
+
+size_t HardwareSerial::print(unsigned int n, int base) {
+    return print((unsigned long) n, base);
+}
+
+size_t HardwareSerial::print(long n, int base) {
+    if (base == DEC && n < 0) {
+        return print('-') + print((unsigned long) -n, base);
+    }
+    return print((unsigned long) n, base);
+}
+
+size_t HardwareSerial::print(unsigned long n, int base) {
+    if (base < 2) {
+        base = DEC;
+    }
+    char buf[8 * sizeof(long) + 1];
+    char* str = &buf[sizeof(buf) - 1];
+    *str = '\0';
+    do {
+        char c = n % base;
+        n /= base;
+        *--str = c < 10 ? c + '0' : c + 'A' - 10;
+    } while (n);
+    return write(str);
+}
+
+size_t HardwareSerial::print(double n, int digits) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.*f", digits, n);
+    return write(buf);
+}
+
+size_t HardwareSerial::println() {
+    return write("\r\n");
+}
+
+//Sketch
+
+namespace native {
+    void SetBusService(bool(*service)(int timeoutMs, void* param), void* param) {
+        g_BusService = service;
+        g_BusServiceParam = param;
+    }
+
+    void SetAnalogValue(uint8_t pin, int value) {
+        if (pin < NUM_PINS) {
+            g_AnalogValues[pin] = value;
+        }
+    }
+
+    void SetPinLevel(uint8_t pin, uint8_t level) {
+        digitalWrite(pin, level);
+    }
+
+    uint8_t GetPinLevel(uint8_t pin) {
+        return digitalRead(pin);
+    }
+
+    int RunSketch(int wireFd) {
+        g_StartMicros = MonotonicMicros();
+        g_BusOpen = true;
+        Wire.AttachBus(wireFd);
+        setvbuf(stdout, nullptr, _IOLBF, 0);
+
+        sei();
+        setup();
+        while (g_BusOpen) {
+            loop();
+            //the loop body runs at least every millisecond, and right away when the master talks to us
+            ServiceBus(1);
+        }
+        return 0;
+    }
+
+    int Main(int argc, char** argv) {
+        int wireFd = -1;
+        for (int i = 1; i < argc; i++) {
+            int pin, value;
+            if (sscanf(argv[i], "wire=%d", &value) == 1) {
+                wireFd = value;
+            }
+            else if (sscanf(argv[i], "a%d=%d", &pin, &value) == 2) {
+                SetAnalogValue(A0 + pin, value);
+            }
+            else {
+                fprintf(stderr, "Unknown argument %s\n", argv[i]);
+                return 1;
+            }
+        }
+        return RunSketch(wireFd);
+    }
+}
+
+__attribute__((weak)) int main(int argc, char** argv) {
+    return native::Main(argc, argv);
+}
@@ -0,0 +1,223 @@
+#ifndef __ARDUINO_H
+#define __ARDUINO_H
+
+/*
+Host stand-in for the parts of the Arduino core that BombuhClient and the modules use.
+Everything runs on one thread - I2C interrupts are delivered between loop() passes and during delay().
+*/
+
+#define ARDUINO_NATIVE
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include <type_traits>
+
+//PROGMEM - the host has a single address space
+
+#define PROGMEM
+#define PSTR(s) (s)
+#define F(s) (s)
+#define pgm_read_byte(addr) (*(const uint8_t*)(addr))
+#define pgm_read_word(addr) (*(const uint16_t*)(addr))
+#define pgm_read_dword(addr) (*(const uint32_t*)(addr))
+#define printf_P printf
+#define sprintf_P sprintf
+#define snprintf_P snprintf
+#define puts_P puts
+#define strlen_P strlen
+#define strcmp_P strcmp
+#define strcpy_P strcpy
+#define memcpy_P memcpy
+
+//Registers
+
+#define _BV(bit) (1 << (bit))
+
+#define SREG_I 7
+#define TWGCE 0
+
+extern volatile uint8_t SREG;
+extern volatile uint8_t TWAR;
+
+inline void cli() {
+    SREG &= ~_BV(SREG_I);
+}
+
+inline void sei() {
+    SREG |= _BV(SREG_I);
+}
+
+#define interrupts() sei()
+#define noInterrupts() cli()
+
+//Pins (ATmega328 numbering)
+
+#define HIGH 0x1
+#define LOW  0x0
+
+#define INPUT 0x0
+#define OUTPUT 0x1
+#define INPUT_PULLUP 0x2
+
+#define NUM_DIGITAL_PINS 20
+
+#define A0 14
+#define A1 15
+#define A2 16
+#define A3 17
+#define A4 18
+#define A5 19
+#define A6 20
+#define A7 21
+
+#define NUM_PINS 22
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+int analogRead(uint8_t pin);
+void analogWrite(uint8_t pin, int val);
+
+void tone(uint8_t pin, unsigned int frequency, unsigned long duration = 0);
+void noTone(uint8_t pin);
+
+//Time
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+//Math
+
+#define PI 3.1415926535897932384626433832795
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+long random(long howbig);
+long random(long howsmall, long howbig);
+void randomSeed(unsigned long seed);
+
+template<typename A, typename B>
+inline auto min(A a, B b) -> typename std::remove_reference<decltype(a < b ? a : b)>::type {
+    return a < b ? a : b;
+}
+
+template<typename A, typename B>
+inline auto max(A a, B b) -> typename std::remove_reference<decltype(a > b ? a : b)>::type {
+    return a > b ? a : b;
+}
+
+template<typename T, typename L, typename H>
+inline T constrain(T x, L low, H high) {
+    return x < low ? low : (x > high ? high : x);
+}
+
+inline long map(long x, long inMin, long inMax, long outMin, long outMax) {
+    return (x - inMin) * (outMax - outMin) / (inMax - inMin) + outMin;
+}
+
+//Serial
+
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+
+class HardwareSerial {
+public:
+    typedef void(*OutputHandler)(const uint8_t* data, size_t size, void* param);
+
+private:
+    static constexpr size_t INPUT_SIZE = 256;
+
+    uint8_t       m_Input[INPUT_SIZE];
+    size_t        m_InputHead;
+    size_t        m_InputCount;
+
+    OutputHandler m_Output;
+    void*         m_OutputParam;
+
+public:
+    HardwareSerial();
+
+    void begin(unsigned long baud);
+    void end() {}
+    void flush();
+
+    //Host side, for a port that is a line rather than the console: bytes for the sketch to receive
+    //(there is no console input), and where what it writes goes instead of stdout
+    size_t Feed(const uint8_t* data, size_t size);
+    void SetOutput(OutputHandler output, void* param);
+
+    int available();
+    int read();
+    int peek();
+
+    size_t write(uint8_t c);
+    size_t write(const char* str);
+    size_t write(const uint8_t* buffer, size_t size);
+
+    size_t print(const char* str);
+    size_t print(char c);
+    size_t print(int n, int base = DEC);
+    size_t print(unsigned int n, int base = DEC);
+    size_t print(long n, int base = DEC);
+    size_t print(unsigned long n, int base = DEC);
+    size_t print(double n, int digits = 2);
+
+    template<typename T>
+    size_t println(T value) {
+        return print(value) + println();
+    }
+
+    template<typename T>
+    size_t println(T value, int format) {
+        return print(value, format) + println();
+    }
+
+    size_t println();
+
+    operator bool() {
+        return true;
+    }
+};
+
+extern HardwareSerial Serial;
+
+//Sketch
+
+void setup();
+void loop();
+
+namespace native {
+    /*
+    Runs setup() and then loop() forever. wireFd is one end of a SOCK_SEQPACKET socket pair
+    carrying the simulated I2C bus (see Wire.h), or -1 to run without a bus.
+    Returns once the other end of the bus is closed.
+    */
+    int RunSketch(int wireFd);
+
+    /*
+    Parses "wire=<fd>" and "a<n>=<value>" (analog input preset, e.g. a6=512 to pick the I2C address) and runs the sketch.
+    This is the default main() - a program that hosts several sketches can call it from its own.
+    */
+    int Main(int argc, char** argv);
+
+    /*
+    Replaces Wire as what the sketch services between loops and while it waits, for links other than I2C.
+    The service waits up to timeoutMs for one transaction and returns false once the link is closed.
+    */
+    void SetBusService(bool(*service)(int timeoutMs, void* param), void* param);
+
+    void SetAnalogValue(uint8_t pin, int value);
+    void SetPinLevel(uint8_t pin, uint8_t level);
+    uint8_t GetPinLevel(uint8_t pin);
+}
+
+#endif
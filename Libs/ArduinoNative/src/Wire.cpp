@@ -0,0 +1,179 @@
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "Wire.h"
+
+TwoWire Wire;
+
+TwoWire::TwoWire() :
+    m_BusFd{-1},
+    m_RxIndex{0},
+    m_RxLength{0},
+    m_TxLength{0},
+    m_InRequest{false},
+    m_ClockSpeed{100000},
+    m_OnReceive{nullptr},
+    m_OnRequest{nullptr} {
+
+}
+
+void TwoWire::begin() {
+    TWAR = 0;
+}
+
+void TwoWire::begin(uint8_t address) {
+    //same as twi_setAddress - the 7-bit address sits above the TWGCE bit
+    TWAR = address << 1;
+}
+
+void TwoWire::end() {
+    TWAR = 0;
+}
+
+void TwoWire::setClock(uint32_t clock) {
+    m_ClockSpeed = clock;
+}
+
+void TwoWire::onReceive(void(*handler)(int)) {
+    m_OnReceive = handler;
+}
+
+void TwoWire::onRequest(void(*handler)()) {
+    m_OnRequest = handler;
+}
+
+size_t TwoWire::write(uint8_t data) {
+    return write(&data, 1);
+}
+
+size_t TwoWire::write(const uint8_t* data, size_t quantity) {
+    if (!m_InRequest) {
+        return 0;
+    }
+    if (m_TxLength + quantity > BUFFER_LENGTH) {
+        //twi_transmit drops the whole chunk, but Wire still reports it as written
+        fprintf(stderr, "Wire: transmit buffer overflow, %d bytes lost\n", (int) quantity);
+        return quantity;
+    }
+    memcpy(m_TxBuffer + m_TxLength, data, quantity);
+    m_TxLength += quantity;
+    return quantity;
+}
+
+int TwoWire::available() {
+    return m_RxLength - m_RxIndex;
+}
+
+int TwoWire::read() {
+    if (m_RxIndex < m_RxLength) {
+        return m_RxBuffer[m_RxIndex++];
+    }
+    return -1;
+}
+
+int TwoWire::peek() {
+    if (m_RxIndex < m_RxLength) {
+        return m_RxBuffer[m_RxIndex];
+    }
+    return -1;
+}
+
+size_t TwoWire::readBytes(uint8_t* buffer, size_t length) {
+    size_t count = min(length, (size_t) available());
+    memcpy(buffer, m_RxBuffer + m_RxIndex, count);
+    m_RxIndex += count;
+    return count;
+}
+
+void TwoWire::AttachBus(int fd) {
+    m_BusFd = fd;
+}
+
+bool TwoWire::IsAddressed(uint8_t address) {
+    if (!TWAR) {
+        return false;
+    }
+    if (address == GENERAL_CALL_ADDRESS) {
+        return TWAR & _BV(TWGCE);
+    }
+    return address == (TWAR >> 1);
+}
+
+void TwoWire::HandleFrame(const uint8_t* frame, size_t size) {
+    if (size < 2) {
+        return;
+    }
+    uint8_t reply[1 + MAX_READ_SIZE];
+    size_t replySize;
+
+    uint8_t saveSREG = SREG;
+    cli();
+    switch (frame[0]) {
+        case FRAME_WRITE:
+            reply[0] = FRAME_ACK;
+            reply[1] = IsAddressed(frame[1]);
+            replySize = 2;
+            if (reply[1]) {
+                m_RxLength = min(size - 2, (size_t) BUFFER_LENGTH);
+                m_RxIndex = 0;
+                memcpy(m_RxBuffer, frame + 2, m_RxLength);
+                if (m_OnReceive) {
+                    m_OnReceive(m_RxLength);
+                }
+                m_RxLength = 0;
+                m_RxIndex = 0;
+            }
+            break;
+        case FRAME_READ: {
+            size_t len = (size > 2) ? frame[2] : 1;
+            m_TxLength = 0;
+            if (IsAddressed(frame[1]) && frame[1] != GENERAL_CALL_ADDRESS && m_OnRequest) {
+                m_InRequest = true;
+                m_OnRequest();
+                m_InRequest = false;
+            }
+            reply[0] = FRAME_DATA;
+            size_t have = min((size_t) m_TxLength, len);
+            memcpy(reply + 1, m_TxBuffer, have);
+            memset(reply + 1 + have, 0xFF, len - have);
+            replySize = len + 1;
+            break;
+        }
+        default:
+            fprintf(stderr, "Wire: unknown bus frame %02X\n", frame[0]);
+            SREG = saveSREG;
+            return;
+    }
+    SREG = saveSREG;
+
+    while (send(m_BusFd, reply, replySize, 0) < 0 && errno == EINTR) {}
+}
+
+bool TwoWire::Service(int timeoutMs) {
+    if (m_BusFd < 0) {
+        if (timeoutMs > 0) {
+            usleep(timeoutMs * 1000);
+        }
+        return true;
+    }
+    if (!(SREG & _BV(SREG_I))) {
+        //interrupts are off - the transaction waits, just like clock stretching would make it
+        return true;
+    }
+    pollfd pfd {m_BusFd, POLLIN, 0};
+    int ready;
+    while ((ready = poll(&pfd, 1, timeoutMs)) < 0 && errno == EINTR) {}
+    if (ready <= 0) {
+        return true;
+    }
+    uint8_t frame[2 + MAX_WRITE_SIZE];
+    ssize_t size;
+    while ((size = recv(m_BusFd, frame, sizeof(frame), 0)) < 0 && errno == EINTR) {}
+    if (size <= 0) {
+        return false;
+    }
+    HandleFrame(frame, (size_t) size);
+    return true;
+}
@@ -0,0 +1,98 @@
+#ifndef __WIRE_H
+#define __WIRE_H
+
+#include "Arduino.h"
+
+#define BUFFER_LENGTH 32
+
+#define WIRE_HAS_END 1
+
+/*
+Simulated TwoWire slave.
+
+The bus is a SOCK_SEQPACKET socket, one message per I2C transaction. The master side sends
+    'W' addr data...    - master write, answered by 'A' ack (1 = address acknowledged)
+    'R' addr len        - master read, answered by 'D' and exactly len bytes (0xFF past what onRequest wrote)
+Address 0 is the general call, which is only accepted when TWGCE is set in TWAR.
+Like the AVR TWI driver, at most BUFFER_LENGTH bytes are received or transmitted per transaction.
+*/
+class TwoWire {
+public:
+    static constexpr uint8_t FRAME_WRITE = 'W';
+    static constexpr uint8_t FRAME_READ = 'R';
+    static constexpr uint8_t FRAME_ACK = 'A';
+    static constexpr uint8_t FRAME_DATA = 'D';
+
+    static constexpr uint8_t GENERAL_CALL_ADDRESS = 0;
+
+    static constexpr size_t MAX_WRITE_SIZE = 256; //longer master writes are truncated by the socket
+    static constexpr size_t MAX_READ_SIZE = 255;
+
+private:
+    int      m_BusFd;
+
+    uint8_t  m_RxBuffer[BUFFER_LENGTH];
+    uint8_t  m_RxIndex;
+    uint8_t  m_RxLength;
+
+    uint8_t  m_TxBuffer[BUFFER_LENGTH];
+    uint8_t  m_TxLength;
+    bool     m_InRequest;
+
+    uint32_t m_ClockSpeed;
+
+    void(*   m_OnReceive)(int);
+    void(*   m_OnRequest)();
+
+    bool IsAddressed(uint8_t address);
+
+    void HandleFrame(const uint8_t* frame, size_t size);
+
+public:
+    TwoWire();
+
+    void begin();
+    void begin(uint8_t address);
+    inline void begin(int address) {
+        begin((uint8_t) address);
+    }
+    void end();
+
+    void setClock(uint32_t clock);
+
+    void onReceive(void(*handler)(int));
+    void onRequest(void(*handler)());
+
+    size_t write(uint8_t data);
+    size_t write(const uint8_t* data, size_t quantity);
+    inline size_t write(const char* data, size_t quantity) {
+        return write(reinterpret_cast<const uint8_t*>(data), quantity);
+    }
+
+    int available();
+    int read();
+    int peek();
+    size_t readBytes(uint8_t* buffer, size_t length);
+    inline size_t readBytes(char* buffer, size_t length) {
+        return readBytes(reinterpret_cast<uint8_t*>(buffer), length);
+    }
+
+    inline uint32_t getClock() {
+        return m_ClockSpeed;
+    }
+
+    //Host side
+
+    void AttachBus(int fd);
+
+    /*
+    Delivers one bus transaction to the onReceive/onRequest handlers, waiting up to timeoutMs for it.
+    The sketch loop gets to run between any two transactions, as it would on a 16 MHz part at I2C speeds.
+    Returns false if the bus was closed by the master.
+    */
+    bool Service(int timeoutMs);
+};
+
+extern TwoWire Wire;
+
+#endif
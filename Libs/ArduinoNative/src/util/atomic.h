@@ -0,0 +1,40 @@
+#ifndef __UTIL_ATOMIC_H
+#define __UTIL_ATOMIC_H
+
+#include "Arduino.h"
+
+//Same shape as avr-libc's util/atomic.h, acting on the simulated SREG
+
+static inline uint8_t __iCliRetVal() {
+    cli();
+    return 1;
+}
+
+static inline uint8_t __iSeiRetVal() {
+    sei();
+    return 1;
+}
+
+static inline void __iSeiParam(const uint8_t* __s) {
+    sei();
+    (void) __s;
+}
+
+static inline void __iCliParam(const uint8_t* __s) {
+    cli();
+    (void) __s;
+}
+
+static inline void __iRestore(const uint8_t* __s) {
+    SREG = *__s;
+}
+
+#define ATOMIC_BLOCK(type) for (type, __ToDo = __iCliRetVal(); __ToDo; __ToDo = 0)
+#define NONATOMIC_BLOCK(type) for (type, __ToDo = __iSeiRetVal(); __ToDo; __ToDo = 0)
+
+#define ATOMIC_RESTORESTATE uint8_t sreg_save __attribute__((__cleanup__(__iRestore))) = SREG
+#define ATOMIC_FORCEON uint8_t sreg_save __attribute__((__cleanup__(__iSeiParam))) = 0
+#define NONATOMIC_RESTORESTATE uint8_t sreg_save __attribute__((__cleanup__(__iRestore))) = SREG
+#define NONATOMIC_FORCEOFF uint8_t sreg_save __attribute__((__cleanup__(__iCliParam))) = 0
+
+#endif
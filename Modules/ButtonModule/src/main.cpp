@@ -178,8 +178,8 @@ public:
 		unsigned long Duration;
 	};
 
-	static FadeEventParam* CreateStripAnimation(uint32_t srcColor, uint32_t dstColor, unsigned long length) {
-		return new FadeEventParam{srcColor, dstColor, 0, length};
+	static FadeEventParam CreateStripAnimation(uint32_t srcColor, uint32_t dstColor, unsigned long length) {
+		return FadeEventParam{srcColor, dstColor, 0, length};
 	}
 
 	inline uint8_t LerpChannel(uint8_t l, uint8_t r, float weight) {
@@ -206,8 +206,7 @@ public:
 			param->StartTime = millis();
 		}
 		if (mod->AnimateLedStrip(param)) {
-			FadeEventParam* pulseBack = mod->CreateStripAnimation(param->DstColor.ARGB, param->SrcColor.ARGB, param->Duration);
-			event->Then(new Event(PulseLoopEvent, pulseBack));
+			event->ThenWithData(PulseLoopEvent, mod->CreateStripAnimation(param->DstColor.ARGB, param->SrcColor.ARGB, param->Duration));
 			return true;
 		}
 		return false;
@@ -230,10 +229,8 @@ public:
 	}
 
 	void StartStripAnimation(uint32_t rgb) {
-		Event* animation = new Event(AnimateEvent, CreateStripAnimation(0x000000, rgb, 500));
-		/*animation->Then(
-			new Event(PulseLoopEvent, CreateStripAnimation(rgb, DarkenColor(rgb), 1000))
-		);*/
+		Event* animation = Event::WithData(AnimateEvent, CreateStripAnimation(0x000000, rgb, 500));
+		/*animation->ThenWithData(PulseLoopEvent, CreateStripAnimation(rgb, DarkenColor(rgb), 1000));*/
 		m_Events.Start(animation);
 	}
 
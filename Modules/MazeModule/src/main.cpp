@@ -297,12 +297,16 @@ public:
 
 		SetEdgeLight(0xFF0000);
 
-		m_Events
-		.Start(game::CreateWaitEvent<MazeModule>(1000))
-		->Then(function(Event* e, MazeModule* maze) {
-			maze->SetEdgeLight(0x000000);
-			return true;
-		});
+		Event* wait = m_Events.Start(game::CreateWaitEvent<MazeModule>(1000));
+		if (wait) {
+			wait->Then(function(Event* e, MazeModule* maze) {
+				maze->SetEdgeLight(0x000000);
+				return true;
+			});
+		}
+		else {
+			SetEdgeLight(0x000000);
+		}
 	}
 
 	void ActiveUpdate() override {
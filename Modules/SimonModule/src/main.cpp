@@ -136,9 +136,13 @@ public:
 	}
 
 	game::EventChainHandle<SimonModule> m_DemoEvents;
+	//the demo only ends early when the event pools run dry, it is started again after this many ms
+	static constexpr unsigned long DEMO_RETRY_INTERVAL = 1000;
+	unsigned long m_DemoStartedAt = 0;
 
 	void StartDemoEvent(unsigned long initialDelay) {
 		StartEvent(GenerateDemoEvents(initialDelay), &m_DemoEvents);
+		m_DemoStartedAt = millis();
 	}
 
 	void Arm() override {
@@ -177,38 +181,57 @@ public:
 			}
 			#endif
 			Event* turnOff = game::CreateWaitEvent<SimonModule>(450);
-			turnOff->Then((new Event(function(Event* event, SimonModule* mod, SimonButton* btn) {
+			Event* off = new Event(function(Event* event, SimonModule* mod, SimonButton* btn) {
 				btn->TurnOff();
 				return true;
-			}, b))->SetDataPermanent());
-			mod->StartEvent(turnOff, &mod->m_FlashOffHandles[b->m_Color]);
+			}, b);
+			if (off) {
+				off->SetDataPermanent();
+			}
+			if (turnOff) {
+				turnOff->Then(off);
+				mod->StartEvent(turnOff, &mod->m_FlashOffHandles[b->m_Color]);
+			}
+			else {
+				delete off;
+				b->TurnOff();
+			}
 		}
 		return true;
 	}
 
 	Event* GenerateDemoEvents(long initialDelay) {
 		Event* event = game::CreateWaitEvent<SimonModule>(initialDelay);
+		if (!event) {
+			return nullptr;
+		}
 		Event* last = event;
 		for (int i = 0; i < m_CurrentSequenceLength; i++) {
 			last = last
-					->Then(new Event(FlashButtonEvent, new int(m_Sequence[i])))
+					->ThenWithData(FlashButtonEvent, m_Sequence[i])
 					->Then(game::CreateWaitEvent<SimonModule>(600));
 		}
 		last->Then(new Event(function(Event* event, SimonModule* mod) {
-			event->Then(mod->GenerateDemoEvents(5000));
+			//a sequence that could not be made whole is not played at all, ActiveUpdate starts over
+			if (event->Then(mod->GenerateDemoEvents(5000))->IsBroken()) {
+				PRINTLN_P("Demo sequence not repeated!");
+			}
 			return true;
 		}));
 		return event;
 	}
 
 	void ActiveUpdate() override {
+		if (!m_DemoEvents.IsRunning() && millis() - m_DemoStartedAt >= DEMO_RETRY_INTERVAL) {
+			StartDemoEvent(2000);
+		}
 		for (int i = 0; i < COLOR_MAX; i++) {
 			SimonButton& btn = m_Buttons[i];
 			if (btn.IsPressed()) {
 				m_HasInteracted = true;
 				m_DemoEvents.Cancel();
 				if (GetRequestedColor() == btn.m_Color) {
-					StartEvent(new Event(FlashButtonEvent, new int(btn.m_Color)));
+					StartEvent(Event::WithData(FlashButtonEvent, btn.m_Color));
 					m_InputPos++;
 					if (m_InputPos == m_CurrentSequenceLength) {
 						m_InputPos = 0;
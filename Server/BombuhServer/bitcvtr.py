@@ -39,6 +39,16 @@ class DataInput:
     
     def read_u32(self) -> int:
         return to_u32(self.io.read(4))
+
+    def read_varint(self) -> int:
+        value = 0
+        shift = 0
+        while True:
+            byte = self.read_u8()
+            value |= (byte & 0x7F) << shift
+            if not (byte & 0x80):
+                return value
+            shift += 7
     
     def read_str(self) -> str:
         size = self.read_u8()
@@ -7,4 +7,11 @@ PIN_I2C_SCL = 5
 PIN_SPI_CS = 7
 PIN_SPI_MISO = 10
 
-I2C_BAUDRATE = 28800
\ No newline at end of file
+I2C_BAUDRATE = 28800
+# "i2c" or "rs485", the modules must be built with the matching transport
+BUS_LINK = "i2c"
+PIN_RS485_TX = 8
+PIN_RS485_RX = 9
+PIN_RS485_DE = 6
+RS485_BAUDRATE = 250000
+RS485_TIMEOUT_MS = 20
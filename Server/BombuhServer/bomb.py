@@ -256,10 +256,29 @@ class VirtualModule:
     def comm_event(self, data: bytes) -> bytes:
         self.handle_event(data[0], data[1:])
         return bytes()
+
+    def comm_event_batch(self, data: bytes) -> bytes:
+        pos = 1
+        count = data[0] if len(data) else 0
+        for i in range(count):
+            # a record that runs past the packet is garbage, and so is anything after it
+            if (pos + 2 > len(data) or pos + 2 + data[pos + 1] > len(data)):
+                print("Event batch truncated at record", i, "of", count)
+                break
+            size = data[pos + 1]
+            self.handle_event(data[pos], data[pos + 2:pos + 2 + size])
+            pos += 2 + size
+        return bytes()
     
+    def comm_stats(self, data: bytes) -> bytes:
+        # bucket count, no handlers, no commands
+        return bytes([8, 0, 0])
+
     def comm_handshake(self, data: bytes) -> bytes:
         out: DataOutput = DataOutput()
         out.write_cstr("Julka")
+        out.write_u32(400000) # max clock, never on the bus anyway
+        out.write_u8(0) # link errors
         out.write_u32(self.event_bits)
         out.write_u8(0) #type = module
         out.write_str(self.name)
@@ -304,13 +323,15 @@ class VirtualModule:
         return out.buffer()
 
     def handle_packet(self, data: bytes):
-        type = data[0]
+        type = data[0] & ~(Server.CMD_FLAG_NO_ACK | Server.CMD_FLAG_BROADCAST)
         self.next_response = [
             0,
             self.comm_poll,
             self.comm_response,
             self.comm_event,
-            self.comm_handshake
+            self.comm_handshake,
+            self.comm_event_batch,
+            self.comm_stats
         ][type](data[1:])
 
     def respond(self) -> bytes:
@@ -335,10 +356,17 @@ class VirtualModuleSocket(ClientSocket):
         response = self.mod.respond()
         self.release_mutex()
         return response
+
+    def read_status(self):
+        # virtual modules never queue requests
+        return 0
     
     def id(self) -> int:
         return self.ident
 
+    def is_virtual(self) -> bool:
+        return True
+
 class BaseService:
     address: str
     bomb: 'Bomb'
@@ -361,6 +389,7 @@ def randbool():
 
 class Bomb:
     DECOUPLE_SERIAL_AND_RNG = False
+    BROADCAST_EVENTS = True
     STRIKE_TO_TIMER_SCALE = [1.0, 1.25, 1.5, 3.0, 6.0]
     SERIAL_NUMBER_LENGTH = 6
     SERIAL_NUMBER_CHARS = [ # Based on the logic in KTANE
@@ -444,10 +473,6 @@ class Bomb:
             def respond(self, request):
                 return [bomb.strikes]
             
-        class GetClockHandler(RequestHandler):
-            def respond(self, request):
-                return bitcvtr.from_u32(bomb.real_timer_int()) + bitcvtr.from_f32(bomb.timer_scale)
-            
         class DeviceSpecificHandlerBase(RequestHandler):
             def decode(self, device: DeviceHandle, io: DataInput):
                 return {'deviceid': device.unique_id()}
@@ -487,7 +512,6 @@ class Bomb:
                 print(request["type"], "|", request["text"])
 
         srv.regist_handler("GetStrikes", GetStrikesHandler())
-        srv.regist_handler("GetClock", GetClockHandler())
         srv.regist_handler("AckReadyToArm", AckReadyToArmHandler())
         srv.regist_handler("GetBombConfig", GetBombConfigHandler())
         srv.regist_handler("GetComponentConfigByBusAddress", GetComponentConfigHandler())
@@ -656,9 +680,6 @@ class Bomb:
             self.release_configs()
 
     def handshake_callback(self, dev: DeviceHandle, io: DataInput):
-        check: str = io.read_cstr()
-        if (Server.str_hash(check) != 708580220):
-            return False
         event_bits = io.read_u32()
         type = io.read_u8()
         map = [ModuleHandle, LabelHandle, PortHandle, BatteryHandle]
@@ -685,6 +706,20 @@ class Bomb:
         self.device_mutex.release()
         gc.collect()
 
+    def get_client_stats(self, reset: bool = False) -> list:
+        ret = []
+        self.device_mutex.lock()
+        for comp in self.all_components:
+            if comp.comm_device.is_virtual():
+                continue
+            stats = self.srv.read_client_stats(comp.comm_device.__socket__, reset)
+            if stats is not None:
+                stats['id'] = comp.id()
+                stats['name'] = getattr(comp, 'name', type(comp).__name__)
+                ret.append(stats)
+        self.device_mutex.release()
+        return ret
+
     def generate_config(self, serial: str) -> BombConfig:
         config = BombConfig()
 
@@ -792,7 +827,7 @@ class Bomb:
         for module in self.modules:
             if (module.flags & ModuleFlag.DEFUSABLE) != 0:
                 self.modules_to_defuse.add(module.id())
-        self.dispatchEvent(BombEvent.ARM)
+        self.dispatchEvent(BombEvent.ARM, self.clock_sync_params)
         self.state = BombState.INGAME
         self.update_timer() #start timer after all modules have been armed
 
@@ -800,8 +835,14 @@ class Bomb:
         return int(self.timer_ms)
     
     def real_timer_int(self) -> int:
+        if self.timer_last_updated is None:
+            return self.timer_int() # not running yet
         ticks = time.ticks_ms()
         return int(self.timer_ms - time.ticks_diff(ticks, self.timer_last_updated) * self.timer_scale)
+
+    def clock_sync_params(self) -> bytes:
+        # payload of ARM and TIMER_SYNC, evaluated for each write
+        return bitcvtr.from_u32(self.real_timer_int()) + bitcvtr.from_f32(self.timer_scale)
     
     def update_timescale(self) -> None:
         self.timer_scale = Bomb.STRIKE_TO_TIMER_SCALE[min(self.strikes, len(Bomb.STRIKE_TO_TIMER_SCALE) - 1)]
@@ -818,8 +859,7 @@ class Bomb:
             self.explode(cause)
         else:
             self.update_timescale()
-            self.dispatchEvent(BombEvent.STRIKE)
-            self.dispatchEvent(BombEvent.TIMER_SYNC) # sync timescale
+            self.dispatchEvents([(BombEvent.STRIKE, None), (BombEvent.TIMER_SYNC, self.clock_sync_params)]) # sync timescale
             self.force_status_report = True
 
     def explode(self, cause: str) -> None:
@@ -854,11 +894,14 @@ class Bomb:
                 self.timer_ms = 0
                 self.explode('Time ran out')
             else:
+                events = []
                 if (self.timer_ms // 1000 != last_timer // 1000):
-                    self.dispatchEvent(BombEvent.TIMER_TICK)
+                    events.append((BombEvent.TIMER_TICK, None))
                 if self.timer_last_synced is None or time.ticks_diff(ts, self.timer_last_synced) > 5000:
-                    self.dispatchEvent(BombEvent.TIMER_SYNC)
+                    events.append((BombEvent.TIMER_SYNC, self.clock_sync_params))
                     self.timer_last_synced = ts
+                if (len(events)):
+                    self.dispatchEvents(events, False) # timer traffic is too frequent to be acknowledged
 
     def is_sync_online(self):
         return self.is_game_running() or self.configuration_in_progress()
@@ -881,10 +924,24 @@ class Bomb:
             self.srv.send_event(comp.comm_device, self.srv.make_event_packet(eventId, params))
 
     def dispatchEvent(self, eventId: int, params = None):
-        packet = self.srv.make_event_packet(eventId, params)
+        self.dispatchEvents([(eventId, params)])
+
+    def dispatchEvents(self, events: list, ack: bool = True):
+        # all events for one component go out in a single bus transaction
+        # a general call is never acknowledged, so only events that need no ack (the timer traffic) are broadcast
+        broadcast = []
         for comp in self.all_components:
-            if comp.accepts_event(eventId):
-                self.srv.send_event(comp.comm_device, packet)
+            accepted = [e for e in events if comp.accepts_event(e[0])]
+            if (Bomb.BROADCAST_EVENTS and not ack and len(accepted) and not comp.comm_device.is_virtual()):
+                for e in accepted:
+                    if e not in broadcast:
+                        broadcast.append(e)
+            elif (len(accepted) == 1):
+                self.srv.send_event(comp.comm_device, self.srv.make_event_packet(accepted[0][0], accepted[0][1]), ack)
+            elif (len(accepted) > 1):
+                self.srv.send_event_batch(comp.comm_device, self.srv.make_event_batch_packet(accepted), ack)
+        if (len(broadcast)):
+            self.srv.broadcast_events([e for e in events if e in broadcast])
 
     def device_event(self, device_id: int, eventId: int, params = None):
         packet = self.srv.make_event_packet(eventId, params)
@@ -0,0 +1,54 @@
+from machine import UART
+from machine import Pin
+import time
+
+import boardconst
+
+class Rs485Bus:
+    """
+    Half-duplex serial bus with the writeto/readfrom/scan calls of machine.I2C, for modules on comm::UartTransport.
+    Every transfer is framed the way the I2C hardware would put it on the wire:
+        'W' addr len data - write, not acknowledged
+        'R' addr len      - read, the addressed module answers with exactly len bytes
+    """
+    FRAME_WRITE = ord('W')
+    FRAME_READ = ord('R')
+    MAX_FRAME = 64 # UART_TRANSPORT_MAX_FRAME of the modules
+
+    uart: UART
+    de: Pin
+    max_transfer: int
+
+    def __init__(self, baud: int) -> None:
+        self.uart = UART(1, baudrate=baud, tx=Pin(boardconst.PIN_RS485_TX), rx=Pin(boardconst.PIN_RS485_RX), timeout=boardconst.RS485_TIMEOUT_MS)
+        self.de = Pin(boardconst.PIN_RS485_DE, Pin.OUT, value=0)
+        self.max_transfer = Rs485Bus.MAX_FRAME
+
+    def transmit(self, frame: bytes) -> None:
+        self.de.value(1)
+        self.uart.write(frame)
+        self.uart.flush()
+        self.de.value(0)
+
+    def writeto(self, addr: int, buf: bytes) -> None:
+        if len(buf) > self.max_transfer:
+            raise OSError("frame too long")
+        self.transmit(bytes([Rs485Bus.FRAME_WRITE, addr, len(buf)]) + buf)
+
+    def readfrom(self, addr: int, size: int, stop = True) -> bytes:
+        self.uart.read() # drop anything left over from a slave that answered late
+        self.transmit(bytes([Rs485Bus.FRAME_READ, addr, size]))
+        ret = self.uart.read(size)
+        if ret is None or len(ret) < size:
+            raise OSError("no answer from", addr)
+        return ret
+
+    def scan(self) -> list[int]:
+        found = []
+        for addr in range(0x08, 0x78):
+            try:
+                self.readfrom(addr, 1)
+                found.append(addr)
+            except OSError:
+                pass
+        return found
@@ -1,5 +1,6 @@
 from machine import I2C
 from machine import Pin
+from rs485 import Rs485Bus
 from io import BytesIO
 import _thread
 import sys
@@ -15,17 +16,44 @@ class ClientSocket:
     COMM_MAGIC_END = 0xEF
     COMM_RESPONSE_COMMAND = 0xFF
 
+    # a bare read of a client with nothing to send returns its status byte
+    STATUS_INVALID = 0x80
+    STATUS_REQUESTS_MASK = 0x0F
+    # broadcast once before the status reads of a sync, so that each client answers the next read with
+    # its status alone instead of the start of a queued packet, which the 1-byte read would cut short
+    STATUS_PROBE = 0xEB
+
+    # the first read of a packet is a short window - enough for an ack, the client fills the rest
+    # with the packets queued after it if their prolog fits, or it is padding
+    # the reads after that get the rest of the packet, a window at most
+    WINDOW_SIZE = 32
+    HEAD_WINDOW_SIZE = 8
+    COMM_PADDING = 0xFF
+    NOT_READY_RETRIES = 16
+
     i2c: I2C
     device: int
     global_i2c_mutex: Semaphore = Semaphore()
+    link_errors: int = 0 # malformed packets read from any client
+
+    max_clock: int
+    reported_errors: int
+
+    rx: bytes # read past the end of the last packet
 
     def __init__(self, i2c, device) -> None:
         self.i2c = i2c
         self.device = device
+        self.rx = bytes()
+        self.max_clock = boardconst.I2C_BAUDRATE
+        self.reported_errors = 0
 
     def id(self) -> int:
         return self.device
 
+    def is_virtual(self) -> bool:
+        return False
+
     def lock_mutex(self):
         ClientSocket.global_i2c_mutex.lock()
 
@@ -44,30 +72,80 @@ class ClientSocket:
         size = len(buf)
         index = 0
         while size > 0:
-            write_size = min(size, 32)
+            write_size = min(size, self.window_size())
             self.send(buf[index:index + write_size])
             size -= write_size
             index += write_size
         self.release_mutex()
 
+    def window_size(self) -> int:
+        # an RS-485 bus takes longer transfers than the I2C buffers
+        return getattr(self.i2c, "max_transfer", ClientSocket.WINDOW_SIZE)
+
+    def read_window(self, size) -> bytes:
+        return self.read(size, True)
+
+    def take_rx(self, size: int) -> bytes:
+        while len(self.rx) < size:
+            self.rx += self.read_window(min(self.window_size(), size - len(self.rx)))
+        ret = self.rx[:size]
+        self.rx = self.rx[size:]
+        return ret
+
     def read_packet(self) -> bytes:
         self.lock_mutex()
-        header = self.read(3, True)
-        if (header[0] != ClientSocket.COMM_MAGIC_START):
-            print("Invalid packet start: ", header)
+        for attempt in range(ClientSocket.NOT_READY_RETRIES):
+            if not self.rx:
+                self.rx = self.read_window(ClientSocket.HEAD_WINDOW_SIZE)
+            start = self.rx[0]
+            if (start == ClientSocket.COMM_MAGIC_START):
+                break
+            self.rx = bytes()
+            if (start & ClientSocket.STATUS_INVALID and start != ClientSocket.COMM_PADDING):
+                print("Invalid packet start: ", start)
+                ClientSocket.link_errors += 1
+                self.release_mutex()
+                return None
+            # a status byte or nothing at all, the client has not got to our command yet
+        else:
+            print("Client not ready")
+            self.release_mutex()
             return None
+
+        header = self.take_rx(3)
         size = bitcvtr.to_u16(header[1:])
-        remaining = size
-        ret = bytes()
-        while remaining > 0:
-            read_size = min(remaining, 32)
-            ret += self.read(read_size, True)
-            remaining -= read_size
+        ret = self.take_rx(size)
+        if (self.rx and self.rx[0] != ClientSocket.COMM_MAGIC_START):
+            self.rx = bytes() # padding, the next packet starts in a new window
 
         print("Read packet, size", size, "content", ret)
         self.release_mutex()
         return ret
     
+    def read_status(self):
+        # read even with a packet waiting already, the probe has armed the client to answer this one read with its status
+        self.lock_mutex()
+        try:
+            status = self.read(1, True)[0]
+        finally:
+            self.release_mutex()
+        if (self.rx):
+            return None # there is a packet waiting already
+        if (status & ClientSocket.STATUS_INVALID):
+            return None # the client has a packet queued
+        return status
+
+    def probe_status(self) -> None:
+        self.lock_mutex()
+        try:
+            self.send(bytes([ClientSocket.STATUS_PROBE]))
+        finally:
+            self.release_mutex()
+
+    def has_pending_requests(self) -> bool:
+        status = self.read_status()
+        return status is None or (status & ClientSocket.STATUS_REQUESTS_MASK) != 0
+
     @staticmethod
     def ensure_bytes(obj) -> bytes:
         if type(obj) is bytes:
@@ -90,6 +168,14 @@ class ClientSocket:
         self.send_packet(data)
         return self.read_packet()
 
+    def post_command(self, cmd: int, params = None) -> None:
+        # the client does not acknowledge posted commands, so there is nothing to read back
+        data = bytes([cmd | Server.CMD_FLAG_NO_ACK])
+        if (params):
+            data += ClientSocket.ensure_bytes(params)
+
+        self.send_packet(data)
+
     @staticmethod
     def is_iterable(obj):
         try:
@@ -122,6 +208,9 @@ class DeviceHandle:
     def issock(self, sock: ClientSocket) -> bool:
         return self.__socket__ is sock
 
+    def is_virtual(self) -> bool:
+        return self.__socket__.is_virtual()
+
 class RequestHandler:
     def decode(self, device: DeviceHandle, io: DataInput) -> object:
         return None
@@ -137,24 +226,95 @@ class Server:
     CMD_RESPONSE = 2
     CMD_EVENT = 3
     CMD_HANDSHAKE = 4
+    CMD_EVENT_BATCH = 5
+    CMD_STATS = 6
+
+    COMMAND_NAMES = ['POLL', 'RESPONSE', 'EVENT', 'HANDSHAKE', 'EVENT_BATCH', 'STATS']
+    STATS_FLAG_RESET = 1
+
+    CMD_FLAG_BROADCAST = 0x40
+    CMD_FLAG_NO_ACK = 0x80
+
+    BROADCAST_ADDRESS = 0 # I2C general call
 
     HANDSHAKE_CHECK_CODE = 0x616C754A
+    HANDSHAKE_CHECK_HASH = 708580220
+
+    # the slowest is what every module can do, the clock we discover and shake hands at
+    CLOCK_RATES = [boardconst.I2C_BAUDRATE, 100000, 400000]
+
+    OPCODE_ESCAPE = 0xFF
 
     i2c: I2C
+    broadcast_socket: ClientSocket
     devices: list[ClientSocket]
     permanent_devices: list[ClientSocket]
 
     handlers: dict[int, RequestHandler]
+    handler_names: dict[int, str]
+    opcode_handlers: list[int]
+
+    clock: int
+    clock_limit: int
+    seen_link_errors: int
 
     mutex: Semaphore
 
     def __init__(self) -> None:
-        self.i2c = I2C(0, freq=boardconst.I2C_BAUDRATE, scl=Pin(boardconst.PIN_I2C_SCL), sda=Pin(boardconst.PIN_I2C_SDA), timeout=1000000)
+        self.clock = boardconst.I2C_BAUDRATE
+        self.clock_limit = Server.CLOCK_RATES[-1]
+        self.seen_link_errors = 0
+        self.i2c = Server.create_i2c(self.clock)
+        self.broadcast_socket = ClientSocket(self.i2c, Server.BROADCAST_ADDRESS)
         self.devices = []
         self.mutex = Semaphore()
         self.handlers = {}
+        self.handler_names = {}
+        self.opcode_handlers = []
         self.permanent_devices = []
 
+    @staticmethod
+    def create_i2c(freq: int) -> I2C:
+        if boardconst.BUS_LINK == "rs485":
+            return Rs485Bus(boardconst.RS485_BAUDRATE)
+        return I2C(0, freq=freq, scl=Pin(boardconst.PIN_I2C_SCL), sda=Pin(boardconst.PIN_I2C_SDA), timeout=1000000)
+
+    def set_clock(self, freq: int) -> None:
+        if (freq == self.clock or boardconst.BUS_LINK != "i2c"):
+            return
+        print("I2C clock", freq)
+        self.clock = freq
+        self.i2c = Server.create_i2c(freq)
+        for sock in self.devices + [self.broadcast_socket]:
+            if not sock.is_virtual():
+                sock.i2c = self.i2c
+
+    def negotiate_clock(self) -> None:
+        # the highest rate every module supports, modules that have seen errors are kept at the lowest
+        usable = self.clock_limit
+        for dev in self.devices:
+            if dev.is_virtual():
+                continue
+            if dev.reported_errors:
+                usable = Server.CLOCK_RATES[0]
+            usable = min(usable, dev.max_clock)
+        freq = Server.CLOCK_RATES[0]
+        for rate in Server.CLOCK_RATES:
+            if rate <= usable:
+                freq = rate
+        self.set_clock(freq)
+
+    def check_link_errors(self) -> None:
+        # step down a rate whenever a client sent garbage since the last check
+        if (ClientSocket.link_errors == self.seen_link_errors):
+            return
+        self.seen_link_errors = ClientSocket.link_errors
+        lower = [rate for rate in Server.CLOCK_RATES if rate < self.clock]
+        if lower:
+            print("Link errors at", self.clock, "Hz, falling back")
+            self.clock_limit = lower[-1]
+            self.set_clock(self.clock_limit)
+
     def i2cwrite(self, addr:int, list) -> None:
         self.i2c.writeto(addr, bytes(list))
 
@@ -167,6 +327,10 @@ class Server:
     def discover(self) -> None:
         self.lock_mutex()
 
+        # new modules may not know faster rates, everyone gets a fresh chance
+        self.clock_limit = Server.CLOCK_RATES[-1]
+        self.set_clock(Server.CLOCK_RATES[0])
+
         self.devices.clear()
         for dev in self.i2c.scan():
             print("Found device", dev)
@@ -198,9 +362,9 @@ class Server:
 
     def shake_hands_with(self, dev: ClientSocket, request, callback):
         self.lock_mutex()
-        handshake_resp = dev.send_command(Server.CMD_HANDSHAKE, request)
+        handshake_resp = dev.send_command(Server.CMD_HANDSHAKE, self.make_handshake_request(request))
         io = DataInput(BytesIO(handshake_resp))
-        if not callback(DeviceHandle(dev), io):
+        if not self.read_handshake_link(dev, io) or not callback(DeviceHandle(dev), io):
             print("Handshake failed!")
             self.devices.remove(dev)
             
@@ -209,13 +373,70 @@ class Server:
     def shake_hands(self, request, callback) -> None:
         self.lock_mutex()
 
+        self.set_clock(Server.CLOCK_RATES[0])
         for dev in self.devices:
             self.shake_hands_with(dev, request, callback)
+        self.negotiate_clock()
+
+        self.release_mutex()
 
+    def read_handshake_link(self, dev: ClientSocket, io: DataInput) -> bool:
+        # check code, then the link info - the rest is for the callback
+        check: str = io.read_cstr()
+        if (Server.str_hash(check) != Server.HANDSHAKE_CHECK_HASH):
+            return False
+        dev.max_clock = io.read_u32()
+        dev.reported_errors = io.read_u8()
+        return True
+
+    @staticmethod
+    def read_latency_record(io: DataInput, bucket_count: int) -> dict:
+        rec = {'count': io.read_u16(), 'min': io.read_u16(), 'max': io.read_u16(), 'mean': io.read_u16()}
+        rec['buckets'] = [io.read_u8() for i in range(bucket_count)]
+        return rec
+
+    def read_client_stats(self, dev: ClientSocket, reset: bool = False) -> dict:
+        # latencies in ms: per handler, how long its requests waited for a POLL and then for our response,
+        # per command, how long the client took to get to it
+        self.lock_mutex()
+        resp = dev.send_command(Server.CMD_STATS, [Server.STATS_FLAG_RESET if reset else 0])
         self.release_mutex()
+        if resp is None:
+            return None
+        io = DataInput(BytesIO(resp))
+        bucket_count = io.read_u8()
+        handler_count = io.read_u8()
+        command_count = io.read_u8()
+        # bucket i counts latencies below 2 << i ms, the last one the rest
+        stats = {'bucket_limits': [2 << i for i in range(bucket_count - 1)], 'handlers': {}, 'commands': {}}
+        for i in range(handler_count):
+            hash = io.read_u32()
+            name = self.handler_names.get(hash, hex(hash))
+            stats['handlers'][name] = {
+                'wait': Server.read_latency_record(io, bucket_count),
+                'response': Server.read_latency_record(io, bucket_count)
+            }
+        for i in range(command_count):
+            name = Server.COMMAND_NAMES[i] if i < len(Server.COMMAND_NAMES) else str(i + Server.CMD_POLL)
+            stats['commands'][name] = Server.read_latency_record(io, bucket_count)
+        return stats
 
     def regist_handler(self, id: str, handler: RequestHandler):
-        self.handlers[Server.str_hash(id)] = handler
+        hash = Server.str_hash(id)
+        if hash not in self.handlers and len(self.opcode_handlers) < Server.OPCODE_ESCAPE:
+            self.opcode_handlers.append(hash)
+        self.handlers[hash] = handler
+        self.handler_names[hash] = id
+
+    def make_handshake_request(self, greeting: bytes) -> bytes:
+        # the greeting, then the handler hashes - clients send the index into this table instead of the hash
+        out = DataOutput()
+        out.write(greeting)
+        out.write_u8(0)
+        out.write_u8(len(self.opcode_handlers))
+        for hash in self.opcode_handlers:
+            out.write_u32(hash)
+        return out.buffer()
 
     @staticmethod
     def str_hash(cmd: str) -> int:
@@ -234,7 +455,12 @@ class Server:
         self.lock_mutex()
         exec_queue = []
 
+        # nothing acknowledges a general call on a bus without modules
+        if any(not device.is_virtual() for device in self.devices):
+            self.broadcast_socket.probe_status()
         for device in self.devices:
+            if not device.has_pending_requests():
+                continue
             response = device.send_command(Server.CMD_POLL)
             if (response is None):
                 continue # read error
@@ -242,8 +468,12 @@ class Server:
             count = file.read_u8()
             for i in range(count):
                 channel = file.read_u8()
-                command_hash = file.read_u32()
-                params_size = file.read_u16()
+                opcode = file.read_u8()
+                if (opcode == Server.OPCODE_ESCAPE):
+                    command_hash = file.read_u32()
+                else:
+                    command_hash = self.opcode_handlers[opcode]
+                params_size = file.read_varint()
                 print("Device", device, "requested command", command_hash, "params size", params_size, "total size", len(response), "pos", file.tell())
                 params_start = file.tell()
                 handler = self.handlers[command_hash]
@@ -252,6 +482,8 @@ class Server:
 
                 file.seek(params_start + params_size)
 
+        self.check_link_errors()
+
         for entry in exec_queue:
             entry[2].execute(entry[3])
 
@@ -266,14 +498,52 @@ class Server:
 
         self.release_mutex()
 
+    @staticmethod
+    def event_params(params):
+        # a callable is evaluated only now, so that time-sensitive data is as fresh as the write
+        return params() if callable(params) else params
+
     def make_event_packet(self, id: int, params = None):
         data = [id]
+        params = Server.event_params(params)
         if (params):
             data += params
         return data
 
-    def send_event(self, dev: DeviceHandle, event_packet):
+    def make_event_batch_packet(self, events: list):
+        data = [len(events)]
+        for (id, params) in events:
+            data.append(id)
+            params = Server.event_params(params)
+            if (params):
+                data.append(len(params))
+                data += params
+            else:
+                data.append(0)
+        return data
+
+    def send_event(self, dev: DeviceHandle, event_packet, ack: bool = True):
         self.lock_mutex()
-        dev.__socket__.send_command(Server.CMD_EVENT, event_packet)
+        if (ack):
+            dev.__socket__.send_command(Server.CMD_EVENT, event_packet)
+        else:
+            dev.__socket__.post_command(Server.CMD_EVENT, event_packet)
+        self.release_mutex()
+
+    def broadcast_events(self, events: list):
+        # one general call write reaches every I2C module, which filter the events by their own masks
+        self.lock_mutex()
+        if (len(events) == 1):
+            self.broadcast_socket.post_command(Server.CMD_EVENT | Server.CMD_FLAG_BROADCAST, self.make_event_packet(events[0][0], events[0][1]))
+        else:
+            self.broadcast_socket.post_command(Server.CMD_EVENT_BATCH | Server.CMD_FLAG_BROADCAST, self.make_event_batch_packet(events))
+        self.release_mutex()
+
+    def send_event_batch(self, dev: DeviceHandle, batch_packet, ack: bool = True):
+        self.lock_mutex()
+        if (ack):
+            dev.__socket__.send_command(Server.CMD_EVENT_BATCH, batch_packet)
+        else:
+            dev.__socket__.post_command(Server.CMD_EVENT_BATCH, batch_packet)
         self.release_mutex()
 
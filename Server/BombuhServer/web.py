@@ -69,6 +69,13 @@ def apiDiscoverModules(client, response: MicroWebSrv._response):
 	wwwBomb.discover_modules()
 	response.WriteResponseOk()
 
+@MicroWebSrv.route('/api/client-stats', 'GET')
+def apiClientStats(client: MicroWebSrv._client, response: MicroWebSrv._response):
+	reset = client.GetRequestQueryParams().get('reset') == '1'
+	stats = wwwBomb.get_client_stats(reset)
+	gc.collect()
+	response.WriteResponseJSONOk(stats)
+
 @MicroWebSrv.route('/api/module-name-dict', 'GET')
 def apiModuleNameDict(client, response: MicroWebSrv._response):
 	ret = dict()
@@ -266,6 +266,55 @@
             });
         }
 
+        function createStatsRow(table, name, rec, limits) {
+            let tr = document.createElement('tr');
+            let hist = rec.buckets.map(function(count, i) {
+                return (i < limits.length ? '<' + limits[i] : '>=' + limits[limits.length - 1]) + ': ' + count;
+            }).join(', ');
+            [name, rec.count, rec.min, rec.mean, rec.max, hist].forEach(function(value, i) {
+                let td = document.createElement(i ? 'td' : 'th');
+                td.textContent = value;
+                tr.appendChild(td);
+            });
+            table.appendChild(tr);
+        }
+
+        function showClientStats(json) {
+            let container = document.getElementById('client-stats');
+            container.innerHTML = '';
+            json.forEach(function(client) {
+                let title = document.createElement('h4');
+                title.textContent = client.name + ' (' + client.id + ')';
+                container.appendChild(title);
+                let table = document.createElement('table');
+                let head = document.createElement('tr');
+                ['', 'počet', 'min ms', 'průměr ms', 'max ms', 'histogram ms'].forEach(function(text) {
+                    let th = document.createElement('th');
+                    th.textContent = text;
+                    head.appendChild(th);
+                });
+                table.appendChild(head);
+                Object.entries(client.handlers).forEach(function([name, stats]) {
+                    createStatsRow(table, name + ' čekání na POLL', stats.wait, client.bucket_limits);
+                    createStatsRow(table, name + ' odpověď', stats.response, client.bucket_limits);
+                });
+                Object.entries(client.commands).forEach(function([name, rec]) {
+                    createStatsRow(table, name, rec, client.bucket_limits);
+                });
+                container.appendChild(table);
+            });
+        }
+
+        addListener('.action-client-stats', function(elem) {
+            elem.disabled = true;
+            ajaxGet('/api/client-stats', elem.dataset.reset ? {'reset': '1'} : {}).then(function(resp) {
+                elem.disabled = false;
+                if (resp.ok) {
+                    resp.json().then(showClientStats);
+                }
+            });
+        });
+
         addListener('.action-debug-event', function(elem) {
             ajaxPost('/api/debug-event', {'type': elem.dataset.event});
         });